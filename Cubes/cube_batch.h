@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#include "vector_math.h"
+
+/***************************
+ * Batched cube transforms *
+ ***************************/
+// Compact transform of a cube standing on the grid, streamed to the vertex shader as instance attributes
+struct CubeInstance {
+    float x;
+    float z;
+    float height;
+};
+
+// Structure of arrays describing count cubes, k-th cube stands at (x[k], 0, z[k]) and has height[k]
+struct CubeBatch {
+    const float* x;
+    const float* z;
+    const float* height;
+    std::size_t count;
+
+    // Cubes [begin, end) of the batch, disjoint slices can be processed by separate threads
+    CubeBatch Slice(std::size_t begin, std::size_t end) const {
+        return { x + begin, z + begin, height + begin, end - begin };
+    }
+};
+
+// Interleaves the batch into out[0, batch.count), vectorized across cubes rather than within one
+inline void BuildCubeInstances(const CubeBatch& batch, CubeInstance* out) {
+    std::size_t k = 0;
+
+#if defined(CUBES_SIMD_SSE2)
+    float* dst = reinterpret_cast<float*>(out);
+    for(; k + 4 <= batch.count; k += 4, dst += 12) {
+        const __m128 x = _mm_loadu_ps(batch.x + k);
+        const __m128 z = _mm_loadu_ps(batch.z + k);
+        const __m128 h = _mm_loadu_ps(batch.height + k);
+
+        // Transpose of four (x, z, height) triples into three registers: x0 z0 h0 x1 | z1 h1 x2 z2 | h2 x3 z3 h3
+        const __m128 xz_low = _mm_unpacklo_ps(x, z);
+        const __m128 xz_high = _mm_unpackhi_ps(x, z);
+        const __m128 hx_low = _mm_unpacklo_ps(h, x);
+        const __m128 hx_high = _mm_unpackhi_ps(h, x);
+        const __m128 zh_low = _mm_unpacklo_ps(z, h);
+        const __m128 zh_high = _mm_unpackhi_ps(z, h);
+
+        _mm_storeu_ps(dst + 0, _mm_shuffle_ps(xz_low, hx_low, _MM_SHUFFLE(3, 0, 1, 0)));
+        _mm_storeu_ps(dst + 4, _mm_shuffle_ps(zh_low, xz_high, _MM_SHUFFLE(1, 0, 3, 2)));
+        _mm_storeu_ps(dst + 8, _mm_shuffle_ps(hx_high, zh_high, _MM_SHUFFLE(3, 2, 3, 0)));
+    }
+#elif defined(CUBES_SIMD_NEON)
+    float* dst = reinterpret_cast<float*>(out);
+    for(; k + 4 <= batch.count; k += 4, dst += 12) {
+        const float32x4x3_t cubes = { { vld1q_f32(batch.x + k), vld1q_f32(batch.z + k), vld1q_f32(batch.height + k) } };
+        vst3q_f32(dst, cubes);
+    }
+#endif
+
+    for(; k < batch.count; k++) {
+        out[k] = { batch.x[k], batch.z[k], batch.height[k] };
+    }
+}
+
+// Clip volume as planes (a, b, c, d), a point is inside when a * x + b * y + c * z + d >= 0 for all of them
+struct Frustum {
+    std::array<vec4, 6> planes;
+};
+
+// Planes are sums and differences of the rows of pv (Gribb and Hartmann), left unnormalized as only signs are tested
+inline Frustum ExtractFrustum(const mat4& pv) {
+    // pv is stored column by column, element i of row j is pv[i][j]
+    const auto row = [&pv](int j) {
+        return vec4{ { pv[0][j], pv[1][j], pv[2][j], pv[3][j] } };
+    };
+
+    Frustum frustum;
+    const vec4 w = row(3);
+    for(int axis = 0; axis < 3; axis++) {
+        const vec4 r = row(axis);
+        for(int i = 0; i < 4; i++) {
+            frustum.planes[2 * axis][i] = w[i] + r[i];
+            frustum.planes[2 * axis + 1][i] = w[i] - r[i];
+        }
+    }
+
+    return frustum;
+}
+
+// Cube k spans [x - 0.5, x + 0.5] x [-height / 2, height / 2] x [z - 0.5, z + 0.5]. Its box is outside when the corner
+// furthest along the plane normal is behind the plane: a * x + c * z + d + (0.5 * (|a| + |c|) + |b| * |height| / 2) < 0.
+// SIMD versions evaluate the same expression in the same order, so every path keeps the same cubes.
+struct CubePlane {
+    float a, c, d;
+    float extent_xz;    // 0.5 * (|a| + |c|)
+    float extent_y;     // |b| / 2
+};
+
+inline std::array<CubePlane, 6> PrepareCubePlanes(const Frustum& frustum) {
+    std::array<CubePlane, 6> planes;
+    for(std::size_t i = 0; i < planes.size(); i++) {
+        const vec4& plane = frustum.planes[i];
+        planes[i] = { plane[0], plane[2], plane[3], 0.5f * (std::abs(plane[0]) + std::abs(plane[2])), 0.5f * std::abs(plane[1]) };
+    }
+    return planes;
+}
+
+inline bool CubeVisibleScalar(const std::array<CubePlane, 6>& planes, float x, float z, float height) {
+    const float h = std::abs(height);
+    for(const CubePlane& p : planes) {
+        if(p.a * x + p.c * z + p.d + (p.extent_xz + p.extent_y * h) < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Writes cubes of the batch that intersect the frustum to out in their original order, returns how many were written
+inline std::size_t CullCubeInstances(const CubeBatch& batch, const Frustum& frustum, CubeInstance* out) {
+    const std::array<CubePlane, 6> planes = PrepareCubePlanes(frustum);
+    std::size_t k = 0;
+    std::size_t visible = 0;
+
+#if defined(CUBES_SIMD_SSE2) || defined(CUBES_SIMD_NEON)
+    // Each iteration tests width cubes against all planes, mask has bit i set when cube k + i is inside.
+    // Groups entirely inside, most of them away from the edges of the frustum, are interleaved as a whole.
+    const auto emit = [&](int mask, std::size_t width) {
+        if(mask == (1 << width) - 1) {
+            BuildCubeInstances(batch.Slice(k, k + width), out + visible);
+            visible += width;
+            return;
+        }
+        for(std::size_t i = 0; i < width; i++) {
+            if(mask & (1 << i)) {
+                out[visible++] = { batch.x[k + i], batch.z[k + i], batch.height[k + i] };
+            }
+        }
+    };
+#endif
+
+#if defined(CUBES_SIMD_AVX)
+    const __m256 sign_mask8 = _mm256_set1_ps(-0.0f);
+    for(; k + 8 <= batch.count; k += 8) {
+        const __m256 x = _mm256_loadu_ps(batch.x + k);
+        const __m256 z = _mm256_loadu_ps(batch.z + k);
+        const __m256 h = _mm256_andnot_ps(sign_mask8, _mm256_loadu_ps(batch.height + k));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for(const CubePlane& p : planes) {
+            const __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(p.a), x), _mm256_mul_ps(_mm256_set1_ps(p.c), z)), _mm256_set1_ps(p.d)),
+                                                  _mm256_add_ps(_mm256_set1_ps(p.extent_xz), _mm256_mul_ps(_mm256_set1_ps(p.extent_y), h)));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_GE_OQ));
+        }
+        emit(_mm256_movemask_ps(inside), 8);
+    }
+#endif
+
+#if defined(CUBES_SIMD_SSE2)
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    for(; k + 4 <= batch.count; k += 4) {
+        const __m128 x = _mm_loadu_ps(batch.x + k);
+        const __m128 z = _mm_loadu_ps(batch.z + k);
+        const __m128 h = _mm_andnot_ps(sign_mask, _mm_loadu_ps(batch.height + k));
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for(const CubePlane& p : planes) {
+            const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.a), x), _mm_mul_ps(_mm_set1_ps(p.c), z)), _mm_set1_ps(p.d)),
+                                               _mm_add_ps(_mm_set1_ps(p.extent_xz), _mm_mul_ps(_mm_set1_ps(p.extent_y), h)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_setzero_ps()));
+        }
+        emit(_mm_movemask_ps(inside), 4);
+    }
+#elif defined(CUBES_SIMD_NEON)
+    const uint32x4_t lane_bits = { 1, 2, 4, 8 };
+    for(; k + 4 <= batch.count; k += 4) {
+        const float32x4_t x = vld1q_f32(batch.x + k);
+        const float32x4_t z = vld1q_f32(batch.z + k);
+        const float32x4_t h = vabsq_f32(vld1q_f32(batch.height + k));
+        uint32x4_t inside = vdupq_n_u32(0xFFFFFFFFu);
+        for(const CubePlane& p : planes) {
+            const float32x4_t distance = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_f32(vdupq_n_f32(p.a), x), vmulq_f32(vdupq_n_f32(p.c), z)), vdupq_n_f32(p.d)),
+                                                   vaddq_f32(vdupq_n_f32(p.extent_xz), vmulq_f32(vdupq_n_f32(p.extent_y), h)));
+            inside = vandq_u32(inside, vcgeq_f32(distance, vdupq_n_f32(0.0f)));
+        }
+        emit(static_cast<int>(vaddvq_u32(vandq_u32(inside, lane_bits))), 4);
+    }
+#endif
+
+    for(; k < batch.count; k++) {
+        if(CubeVisibleScalar(planes, batch.x[k], batch.z[k], batch.height[k])) {
+            out[visible++] = { batch.x[k], batch.z[k], batch.height[k] };
+        }
+    }
+
+    return visible;
+}
+
+// Indices of the cubes ordered nearest first along the view direction from eye to target, so the depth test rejects
+// hidden fragments early. Depths of the cube centers are quantized to 16 bits and sorted by two stable counting passes.
+inline std::vector<std::uint32_t> FrontToBackOrder(const CubeBatch& batch, const vec3& eye, const vec3& target) {
+    const vec3 forward{ target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+    std::vector<float> depths(batch.count);
+    float nearest = std::numeric_limits<float>::max();
+    float farthest = std::numeric_limits<float>::lowest();
+    for(std::size_t k = 0; k < batch.count; k++) {
+        depths[k] = (batch.x[k] - eye[0]) * forward[0] - eye[1] * forward[1] + (batch.z[k] - eye[2]) * forward[2];
+        nearest = std::min(nearest, depths[k]);
+        farthest = std::max(farthest, depths[k]);
+    }
+
+    const float scale = farthest > nearest ? 65535.0f / (farthest - nearest) : 0.0f;
+    std::vector<std::uint16_t> keys(batch.count);
+    for(std::size_t k = 0; k < batch.count; k++) {
+        keys[k] = static_cast<std::uint16_t>((depths[k] - nearest) * scale);
+    }
+
+    std::vector<std::uint32_t> order(batch.count);
+    std::vector<std::uint32_t> sorted(batch.count);
+    std::iota(order.begin(), order.end(), 0u);
+    for(int shift = 0; shift < 16; shift += 8) {
+        std::array<std::size_t, 257> offsets{};
+        for(std::uint32_t k : order) {
+            offsets[((keys[k] >> shift) & 0xFF) + 1]++;
+        }
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+        for(std::uint32_t k : order) {
+            sorted[offsets[(keys[k] >> shift) & 0xFF]++] = k;
+        }
+        order.swap(sorted);
+    }
+
+    return order;
+}
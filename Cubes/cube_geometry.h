@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+
+#include "vector_math.h"
+
+/*****************
+ * Cube geometry *
+ *****************/
+// Four corners per face so every face can have its own attributes, counter-clockwise seen from outside the cube.
+// Corners are stored as whole numbers, the vertex shader scales them down to a unit cube.
+constexpr std::int8_t CubeVertices[] = {
+    // back
+     1, -1, -1,
+    -1, -1, -1,
+    -1,  1, -1,
+     1,  1, -1,
+
+    // front
+    -1, -1,  1,
+     1, -1,  1,
+     1,  1,  1,
+    -1,  1,  1,
+
+    // left
+    -1, -1, -1,
+    -1, -1,  1,
+    -1,  1,  1,
+    -1,  1, -1,
+
+    // right
+     1, -1,  1,
+     1, -1, -1,
+     1,  1, -1,
+     1,  1,  1,
+
+    // down
+    -1, -1, -1,
+     1, -1, -1,
+     1, -1,  1,
+    -1, -1,  1,
+
+    // top
+    -1,  1,  1,
+     1,  1,  1,
+     1,  1, -1,
+    -1,  1, -1
+};
+
+// Faces are emitted one after another and both triangles of a face share their diagonal, so each of the
+// 24 vertices is transformed once with any post-transform cache holding at least 4 entries
+constexpr std::uint16_t CubeIndices[] = {
+     0,  1,  2,   0,  2,  3,    // back
+     4,  5,  6,   4,  6,  7,    // front
+     8,  9, 10,   8, 10, 11,    // left
+    12, 13, 14,  12, 14, 15,    // right
+    16, 17, 18,  16, 18, 19,    // down
+    20, 21, 22,  20, 22, 23     // top
+};
+
+// Faces in CubeVertices order, also their palette index
+enum class CubeFace : std::uint8_t {
+    Back,
+    Front,
+    Left,
+    Right,
+    Down,
+    Top
+};
+
+// Sets of faces are masks with bit n standing for face n
+constexpr std::uint8_t CubeFaceBit(CubeFace face) {
+    return static_cast<std::uint8_t>(1u << static_cast<unsigned>(face));
+}
+constexpr std::uint8_t AllCubeFaces = 0x3F;
+
+// Faces eye can see on at least one of a set of axis-aligned boxes, per axis low is the largest lower and high the
+// smallest upper bound among the boxes. With a fixed camera the others are back faces of every box.
+inline std::uint8_t VisibleCubeFaces(const vec3& eye, const vec3& low, const vec3& high) {
+    constexpr CubeFace lower[] = { CubeFace::Left, CubeFace::Down, CubeFace::Back };
+    constexpr CubeFace upper[] = { CubeFace::Right, CubeFace::Top, CubeFace::Front };
+
+    std::uint8_t faces = 0;
+    for(int axis = 0; axis < 3; axis++) {
+        if(eye[axis] < low[axis]) {
+            faces |= CubeFaceBit(lower[axis]);
+        }
+        if(eye[axis] > high[axis]) {
+            faces |= CubeFaceBit(upper[axis]);
+        }
+    }
+    return faces;
+}
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "cube_geometry.h"
+#include "job_system.h"
+#include "vector_math.h"
+
+/***********************
+ * Heightfield meshing *
+ ***********************/
+// Vertex of a merged mesh, corners are not on the unit cube so they stay floats
+struct MeshVertex {
+    float position[3];
+    std::uint8_t face;
+    std::uint8_t padding[3];
+};
+
+struct Mesh {
+    std::vector<MeshVertex> vertices;
+    std::vector<std::uint32_t> indices;
+    std::uint8_t faces = AllCubeFaces;  // AddBoxFace skips faces outside the mask
+};
+
+// Exchanges vertices and indices, each mesh keeps its face mask. Hands meshes over without copying them, the
+// storage given back is reused by the next rebuild.
+inline void SwapMeshGeometry(Mesh& first, Mesh& second) {
+    first.vertices.swap(second.vertices);
+    first.indices.swap(second.indices);
+}
+
+// Appends the face of the box [low, high] as a quad, corners, winding and diagonal follow the face in CubeVertices and CubeIndices
+inline void AddBoxFace(Mesh& mesh, CubeFace face, const vec3& low, const vec3& high) {
+    if((mesh.faces & CubeFaceBit(face)) == 0) {
+        return;
+    }
+
+    const std::size_t first = 4 * static_cast<std::size_t>(face);
+    const std::uint32_t base = static_cast<std::uint32_t>(mesh.vertices.size());
+    for(std::size_t corner = first; corner < first + 4; corner++) {
+        MeshVertex vertex{};
+        for(int axis = 0; axis < 3; axis++) {
+            vertex.position[axis] = CubeVertices[3 * corner + axis] < 0 ? low[axis] : high[axis];
+        }
+        vertex.face = static_cast<std::uint8_t>(face);
+        mesh.vertices.push_back(vertex);
+    }
+    for(std::size_t i = 0; i < 6; i++) {
+        mesh.indices.push_back(base + CubeIndices[i]);
+    }
+}
+
+// Grid of rows x columns columns, column (i, j) stands on cell (x0 + i, z0 + j) and spans [-height / 2, height / 2]
+// like the cubes of CubeWave. Heights are stored row after row and may not be negative.
+struct Heightfield {
+    std::size_t rows;
+    std::size_t columns;
+    float x0;
+    float z0;
+    const float* heights;
+
+    // Outside of the grid the height is 0
+    float Height(std::ptrdiff_t row, std::ptrdiff_t column) const {
+        if(row < 0 || column < 0 || row >= static_cast<std::ptrdiff_t>(rows) || column >= static_cast<std::ptrdiff_t>(columns)) {
+            return 0.0f;
+        }
+        return heights[row * columns + column];
+    }
+};
+
+// Exposed part of the wall between columns of heights near and far, lying in the plane where axis (0 for x, 2 for z)
+// equals position and spanning [begin, end] along the other horizontal axis. Only the taller column shows a face,
+// one band above and one below the shorter column.
+inline void AddHeightfieldWall(Mesh& mesh, int axis, float position, float begin, float end, float near, float far) {
+    if(near == far) {
+        return;
+    }
+
+    const bool towards_far = near > far;
+    const CubeFace face = axis == 0 ? (towards_far ? CubeFace::Right : CubeFace::Left) : (towards_far ? CubeFace::Front : CubeFace::Back);
+    const float high = 0.5f * std::max(near, far);
+    const float low = 0.5f * std::min(near, far);
+    const auto band = [&](float bottom, float top) {
+        vec3 from, to;
+        from[axis] = to[axis] = position;
+        from[2 - axis] = begin;
+        to[2 - axis] = end;
+        from[1] = bottom;
+        to[1] = top;
+        AddBoxFace(mesh, face, from, to);
+    };
+
+    if(low == 0.0f) {
+        band(-high, high);
+    } else {
+        band(low, high);
+        band(-high, -low);
+    }
+}
+
+// Rows meshed together, faces are merged across the rows of a band but not across bands
+constexpr std::size_t HeightfieldBandRows = 32;
+
+// Rebuilds the mesh of rows [first_row, end_row). Tops and bottoms are merged greedily into rectangles of equal height,
+// walls between columns are merged across rows and walls between rows along them wherever the heights on both sides
+// match. The band owns the walls towards the row after it, the first band also the outer wall.
+inline void MeshHeightfieldBand(const Heightfield& field, std::size_t first_row, std::size_t end_row, Mesh& mesh) {
+    mesh.vertices.clear();
+    mesh.indices.clear();
+
+    const std::ptrdiff_t first = static_cast<std::ptrdiff_t>(first_row);
+    const std::ptrdiff_t end = static_cast<std::ptrdiff_t>(end_row);
+    const std::ptrdiff_t columns = static_cast<std::ptrdiff_t>(field.columns);
+    const auto x = [&field](std::ptrdiff_t i) {
+        return field.x0 + static_cast<float>(i);
+    };
+    const auto z = [&field](std::ptrdiff_t j) {
+        return field.z0 + static_cast<float>(j);
+    };
+
+    // Widest run of equal heights not merged yet, grown over the following rows as long as all of it matches
+    std::vector<char> merged(static_cast<std::size_t>((end - first) * columns), 0);
+    const auto is_free = [&](std::ptrdiff_t i, std::ptrdiff_t j, float height) {
+        return !merged[(i - first) * columns + j] && field.Height(i, j) == height;
+    };
+    for(std::ptrdiff_t i = first; i < end; i++) {
+        for(std::ptrdiff_t j = 0; j < columns; j++) {
+            const float height = field.Height(i, j);
+            if(merged[(i - first) * columns + j] || height <= 0.0f) {
+                continue;
+            }
+
+            std::ptrdiff_t last_column = j;
+            while(last_column + 1 < columns && is_free(i, last_column + 1, height)) {
+                last_column++;
+            }
+            std::ptrdiff_t last_row = i;
+            while(last_row + 1 < end) {
+                std::ptrdiff_t k = j;
+                while(k <= last_column && is_free(last_row + 1, k, height)) {
+                    k++;
+                }
+                if(k <= last_column) {
+                    break;
+                }
+                last_row++;
+            }
+
+            for(std::ptrdiff_t row = i; row <= last_row; row++) {
+                std::fill_n(merged.begin() + (row - first) * columns + j, last_column - j + 1, 1);
+            }
+            const float top = 0.5f * height;
+            AddBoxFace(mesh, CubeFace::Top, { x(i) - 0.5f, top, z(j) - 0.5f }, { x(last_row) + 0.5f, top, z(last_column) + 0.5f });
+            AddBoxFace(mesh, CubeFace::Down, { x(i) - 0.5f, -top, z(j) - 0.5f }, { x(last_row) + 0.5f, -top, z(last_column) + 0.5f });
+        }
+    }
+
+    for(std::ptrdiff_t j = 0; j <= columns; j++) {
+        for(std::ptrdiff_t i = first; i < end;) {
+            const float near = field.Height(i, j - 1);
+            const float far = field.Height(i, j);
+            std::ptrdiff_t run_end = i + 1;
+            while(run_end < end && field.Height(run_end, j - 1) == near && field.Height(run_end, j) == far) {
+                run_end++;
+            }
+            AddHeightfieldWall(mesh, 2, z(j) - 0.5f, x(i) - 0.5f, x(run_end - 1) + 0.5f, near, far);
+            i = run_end;
+        }
+    }
+
+    const auto walls_between_rows = [&](std::ptrdiff_t near_row, std::ptrdiff_t far_row) {
+        for(std::ptrdiff_t j = 0; j < columns;) {
+            const float near = field.Height(near_row, j);
+            const float far = field.Height(far_row, j);
+            std::ptrdiff_t run_end = j + 1;
+            while(run_end < columns && field.Height(near_row, run_end) == near && field.Height(far_row, run_end) == far) {
+                run_end++;
+            }
+            AddHeightfieldWall(mesh, 0, x(near_row) + 0.5f, z(j) - 0.5f, z(run_end - 1) + 0.5f, near, far);
+            j = run_end;
+        }
+    };
+    for(std::ptrdiff_t i = first == 0 ? -1 : first; i < end; i++) {
+        walls_between_rows(i, i + 1);
+    }
+}
+
+// Meshes of the bands of HeightfieldBandRows rows, a band is rebuilt when its heights or the heights of the row after
+// it changed since the last update. Meshes of the rebuilt bands may be taken with SwapMeshGeometry until the next one.
+struct HeightfieldMesher {
+    std::vector<Mesh> bands;
+    std::vector<float> meshed_heights;  // Heights the band meshes were built from
+    std::vector<std::size_t> rebuild;   // Bands rebuilt by the last update
+    std::uint8_t faces = AllCubeFaces;  // Faces kept by the band meshes
+};
+
+// Bands are rebuilt in parallel keeping only the faces in the mask, returns how many were
+inline std::size_t UpdateHeightfieldMesher(HeightfieldMesher& mesher, const Heightfield& field, std::uint8_t faces, JobSystem& jobs) {
+    const std::size_t cells = field.rows * field.columns;
+    const std::size_t bands = (field.rows + HeightfieldBandRows - 1) / HeightfieldBandRows;
+    if(mesher.bands.size() != bands || mesher.meshed_heights.size() != cells || mesher.faces != faces) {
+        Mesh empty;
+        empty.faces = faces;
+        mesher.bands.assign(bands, empty);
+        mesher.meshed_heights.assign(cells, std::numeric_limits<float>::quiet_NaN());
+        mesher.faces = faces;
+    }
+
+    // Rows of a band and the row after it are adjacent in memory
+    mesher.rebuild.clear();
+    for(std::size_t band = 0; band < bands; band++) {
+        const std::size_t begin = band * HeightfieldBandRows * field.columns;
+        const std::size_t end = std::min((band + 1) * HeightfieldBandRows + 1, field.rows) * field.columns;
+        if(!std::equal(field.heights + begin, field.heights + end, mesher.meshed_heights.data() + begin)) {
+            mesher.rebuild.push_back(band);
+        }
+    }
+    if(mesher.rebuild.empty()) {
+        return 0;
+    }
+
+    jobs.ParallelFor(0, mesher.rebuild.size(), 1, [&](std::size_t begin, std::size_t end) {
+        for(std::size_t k = begin; k < end; k++) {
+            const std::size_t band = mesher.rebuild[k];
+            MeshHeightfieldBand(field, band * HeightfieldBandRows, std::min((band + 1) * HeightfieldBandRows, field.rows), mesher.bands[band]);
+        }
+    });
+    std::copy_n(field.heights, cells, mesher.meshed_heights.data());
+
+    return mesher.rebuild.size();
+}
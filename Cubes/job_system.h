@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "profiler.h"
+
+/**************
+ * Job system *
+ **************/
+// Totals since the pool was created
+struct JobCounters {
+    std::atomic<std::uint64_t> jobs{ 0 };
+    std::atomic<std::uint64_t> steals{ 0 };     // Jobs taken from the deque of another worker
+    std::atomic<std::int64_t> idle_ns{ 0 };     // Time workers spent without a job
+    std::atomic<std::int64_t> job_ns{ 0 };      // Sum of job durations
+    std::atomic<std::int64_t> max_job_ns{ 0 };
+};
+
+// Work-stealing pool, every worker owns a deque, pops its own jobs from the back and steals from the front of
+// the others once it runs dry. The thread calling ParallelFor takes part as worker 0, one caller at a time.
+class JobSystem {
+public:
+    using RangeBody = std::function<void(std::size_t, std::size_t)>;
+
+    // threads counts the caller, 0 uses every hardware thread
+    explicit JobSystem(unsigned threads) {
+        if(threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        for(unsigned i = 0; i < threads; i++) {
+            workers.push_back(std::make_unique<Worker>());
+        }
+        for(unsigned i = 1; i < threads; i++) {
+            pool.emplace_back([this, i]() { WorkerLoop(i); });
+        }
+    }
+
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for(std::thread& thread : pool) {
+            thread.join();
+        }
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // Runs body over disjoint chunks of [begin, end) that are multiples of grain except the last, returns once all are done
+    void ParallelFor(std::size_t begin, std::size_t end, std::size_t grain, const RangeBody& body) {
+        std::atomic<std::size_t> remaining{ 0 };
+        Dispatch(begin, end, grain, body, remaining);
+        Wait(remaining);
+    }
+
+    // Queues the chunks of ParallelFor and returns at once, remaining drops back to zero when all of them are done.
+    // Chunks go to the other workers first so the caller is free until it waits, body has to live until then.
+    void Dispatch(std::size_t begin, std::size_t end, std::size_t grain, const RangeBody& body, std::atomic<std::size_t>& remaining) {
+        if(begin >= end) {
+            return;
+        }
+
+        const std::size_t count = end - begin;
+        const std::size_t max_chunks = workers.size() * 4;
+        std::size_t chunk = (count + max_chunks - 1) / max_chunks;
+        chunk = std::max(grain, (chunk + grain - 1) / grain * grain);
+
+        // Chunks are dealt round robin so every worker starts on its own deque
+        const std::size_t chunks = (count + chunk - 1) / chunk;
+        remaining += chunks;
+        const std::size_t first = workers.size() > 1 ? 1 : 0;
+        std::size_t worker = first;
+        for(std::size_t chunk_begin = begin; chunk_begin < end; chunk_begin += chunk) {
+            Worker& target = *workers[worker];
+            {
+                std::lock_guard<std::mutex> lock(target.mutex);
+                target.jobs.push_back({ &body, chunk_begin, std::min(chunk_begin + chunk, end), &remaining });
+            }
+            worker = worker + 1 < workers.size() ? worker + 1 : first;
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            queued += chunks;
+        }
+        wake.notify_all();
+    }
+
+    // Runs queued jobs on the calling thread until remaining drops to zero
+    void Wait(const std::atomic<std::size_t>& remaining) {
+        while(remaining.load(std::memory_order_acquire) > 0) {
+            if(!TryRunJob(0)) {
+                const std::int64_t idle_start = GetTimeNs();
+                std::this_thread::yield();
+                counters.idle_ns += GetTimeNs() - idle_start;
+            }
+        }
+    }
+
+    unsigned ThreadCount() const {
+        return static_cast<unsigned>(workers.size());
+    }
+
+    const JobCounters& Counters() const {
+        return counters;
+    }
+
+private:
+    struct Job {
+        const RangeBody* body;
+        std::size_t begin;
+        std::size_t end;
+        std::atomic<std::size_t>* remaining;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    bool TryRunJob(unsigned worker) {
+        Job job;
+        bool found = false;
+        {
+            Worker& own = *workers[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if(!own.jobs.empty()) {
+                job = own.jobs.back();
+                own.jobs.pop_back();
+                found = true;
+            }
+        }
+
+        for(std::size_t i = 1; !found && i < workers.size(); i++) {
+            Worker& victim = *workers[(worker + i) % workers.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if(!victim.jobs.empty()) {
+                job = victim.jobs.front();
+                victim.jobs.pop_front();
+                found = true;
+                counters.steals++;
+            }
+        }
+
+        if(!found) {
+            return false;
+        }
+        queued--;
+
+        const std::int64_t start = GetTimeNs();
+        {
+            PROFILE_ZONE("Job");
+            (*job.body)(job.begin, job.end);
+        }
+        const std::int64_t duration = GetTimeNs() - start;
+
+        counters.jobs++;
+        counters.job_ns += duration;
+        std::int64_t max = counters.max_job_ns.load(std::memory_order_relaxed);
+        while(duration > max && !counters.max_job_ns.compare_exchange_weak(max, duration)) {
+        }
+
+        job.remaining->fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+    void WorkerLoop(unsigned worker) {
+        NameProfilerThread("Job worker");
+        while(true) {
+            if(TryRunJob(worker)) {
+                continue;
+            }
+
+            const std::int64_t idle_start = GetTimeNs();
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [this]() { return stopping || queued > 0; });
+            counters.idle_ns += GetTimeNs() - idle_start;
+            if(stopping) {
+                return;
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> pool;
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::atomic<std::size_t> queued{ 0 };   // Jobs sitting in deques
+    bool stopping = false;                  // Guarded by sleep_mutex
+    JobCounters counters;
+};
@@ -1,278 +1,193 @@
+#if defined(_WIN32)
+#define NOMINMAX
 #include <Windows.h>
 #include <gl/GL.h>
 #include "glext.h"
 #include "wglext.h"
+#else
+#define GL_GLEXT_LEGACY
+#include <GL/gl.h>
+#include "glext.h"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <poll.h>
+#endif
 
 #include <chrono>
 #include <iostream>
+#include <fstream>
 #include <array>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <limits>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <condition_variable>
 
 #undef near
 #undef far
 
-/********************************
- * OpenGL utilities and helpers *
- ********************************/
- template <class T>
- void LoadOpenGLProc(T& procPointer, const char* name) {
-    procPointer = reinterpret_cast<T>(wglGetProcAddress(name));
-    if(!procPointer) {
-        OutputDebugString("Failed to load function:\n\t");
-        OutputDebugString(name);
-        OutputDebugString("\n");
-        PostQuitMessage(0);
-    }
- }
-
-PFNWGLCHOOSEPIXELFORMATARBPROC wglChoosePixelFormatARB = nullptr;
-PFNWGLCREATECONTEXTATTRIBSARBPROC wglCreateContextAttribsARB = nullptr;
-PFNGLCREATEPROGRAMPROC wglCreateProgram = nullptr;
-PFNGLATTACHSHADERPROC wglAttachShader = nullptr;
-PFNGLLINKPROGRAMPROC wglLinkProgram = nullptr;
-PFNGLCREATESHADERPROC wglCreateShader = nullptr;
-PFNGLSHADERSOURCEPROC wglShaderSource = nullptr;
-PFNGLCOMPILESHADERPROC wglCompileShader = nullptr;
-PFNGLDELETESHADERPROC wglDeleteShader = nullptr;
-PFNGLGENBUFFERSARBPROC wglGenBuffers = nullptr;
-PFNGLGENVERTEXARRAYSPROC wglGenVertexArrays = nullptr;
-PFNGLBINDVERTEXARRAYPROC wglBindVertexArray = nullptr;
-PFNGLBUFFERDATAPROC wglBufferData = nullptr;
-PFNGLENABLEVERTEXATTRIBARRAYPROC wglEnableVertexAttribArray = nullptr;
-PFNGLBINDBUFFERPROC wglBindBuffer = nullptr;
-PFNGLVERTEXATTRIBPOINTERPROC wglVertexAttribPointer = nullptr;
-PFNGLGETUNIFORMLOCATIONPROC wglGetUniformLocation = nullptr;
-PFNGLUSEPROGRAMPROC wglUseProgram = nullptr;
-PFNGLUNIFORMMATRIX4FVPROC wglUniformMatrix4fv = nullptr;
-PFNGLDELETEVERTEXARRAYSPROC wglDeleteVertexArrays = nullptr;
-PFNGLDELETEBUFFERSPROC wglDeleteBuffers = nullptr;
-
-LRESULT CALLBACK WindowCallback(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam) {
-    switch(Msg) {
-        case WM_CLOSE:
-            PostQuitMessage(0);
-            break;
-
-        default:
-            return DefWindowProc(hWnd, Msg, wParam, lParam);
-    }
+#include "vector_math.h"
+#include "profiler.h"
+#include "job_system.h"
+#include "cube_batch.h"
+#include "cube_geometry.h"
+#include "heightfield_mesh.h"
+
+/******************
+ * Platform layer *
+ ******************/
+// Window with an OpenGL 4.0 core context, the rest of the program never touches Win32, X11 or EGL directly.
+// Headless windows are never shown, have no default framebuffer and do not pump events.
+// The main thread creates the window and pumps its events, the render thread makes the context current and draws.
+struct PlatformWindow {
+#if defined(_WIN32)
+    HWND handle = NULL;
+    HDC device_context = NULL;
+    HGLRC render_context = NULL;
+#else
+    Display* display = nullptr;
+    ::Window handle = 0;
+    Colormap colormap = 0;
+    Atom delete_message = 0;
+    EGLDisplay egl_display = EGL_NO_DISPLAY;
+    EGLSurface surface = EGL_NO_SURFACE;
+    EGLContext context = EGL_NO_CONTEXT;
+#endif
+    int width = 0;      // Updated on the render thread as resize events arrive
+    int height = 0;
+    bool headless = false;
+};
 
-    return 0;
-}
+// Keys the render thread reacts to
+enum class PlatformKey {
+    Unknown,
+    Escape
+};
 
-GLuint CreateShader(const char* source, GLenum shader_type) {
-    const GLuint shader = wglCreateShader(shader_type);
-    wglShaderSource(shader, 1, &source, nullptr);
-    wglCompileShader(shader);
-    return shader;
-}
+// Events the main thread forwards to the render thread, quitting is not an event but the sticky QuitRequested flag
+enum class PlatformEventType {
+    Resize,
+    Key
+};
 
-GLuint CreateProgram(GLuint vertex_shader, GLuint fragment_shader) {
-    const GLuint program = wglCreateProgram();
-    wglAttachShader(program, vertex_shader);
-    wglAttachShader(program, fragment_shader);
-    wglLinkProgram(program);
-    return program;
-}
+struct PlatformEvent {
+    PlatformEventType type = PlatformEventType::Resize;
+    int width = 0;
+    int height = 0;
+    PlatformKey key = PlatformKey::Unknown;
+};
 
-static const auto startTime = std::chrono::high_resolution_clock::now();
-float GetTime() {
-    const auto currentTime = std::chrono::high_resolution_clock::now();
-    return std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - startTime).count() / 1000.0f;
-}
+// Lock-free ring with one producer and one consumer thread, Push fails when full and Pop when empty
+template <class T, std::size_t Capacity>
+class SpscQueue {
+public:
+    bool Push(const T& item) {
+        const std::size_t write = tail.load(std::memory_order_relaxed);
+        if(write - head.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
 
-/******************************
- * Math utilities and helpers *
- ******************************/
-constexpr float PI = 3.1415926535897931f;
+        items[write % Capacity] = item;
+        tail.store(write + 1, std::memory_order_release);
+        return true;
+    }
 
-using vec3 = std::array<float, 3>;
-using vec4 = std::array<float, 4>;
-using mat4 = std::array<vec4, 4>;
+    bool Pop(T& item) {
+        const std::size_t read = head.load(std::memory_order_relaxed);
+        if(read == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
 
-bool AlmostEqual(float a, float b) {
-    return std::abs(a - b) < std::numeric_limits<float>::epsilon();
-}
+        item = items[read % Capacity];
+        head.store(read + 1, std::memory_order_release);
+        return true;
+    }
 
-constexpr float ToRadians(float degrees) {
-    return degrees * PI / 180.0f;
-}
+private:
+    std::array<T, Capacity> items{};
+    alignas(64) std::atomic<std::size_t> head{ 0 };    // Next item to pop, written by the consumer
+    alignas(64) std::atomic<std::size_t> tail{ 0 };    // Next slot to push, written by the producer
+};
 
-constexpr float ToDegrees(float radians) {
-    return radians * 180.0f / PI;
-}
+SpscQueue<PlatformEvent, 256> PlatformEvents;
 
-vec3 Normalize(const vec3& vec) {
-    float mag = static_cast<float>(sqrt(pow(vec[0], 2) + pow(vec[1], 2) + pow(vec[2], 2)));
+// Size that did not fit into a full queue as width << 32 | height, 0 once the render thread has applied it. While it
+// is set later sizes replace it instead of being queued, so the render thread never applies an older size last.
+std::atomic<std::uint64_t> OverflowResize{ 0 };
 
-    if (!AlmostEqual(mag, 1.0f)) {
-        return { vec[0] / mag, vec[1] / mag, vec[2] / mag };
-    } else {
-        return vec;
-    }
-}
+// Set by RequestQuit from any thread and never cleared, so quitting cannot be lost to a full queue
+std::atomic<bool> QuitRequested{ false };
 
-constexpr vec3 Cross(const vec3& first, const vec3& second) {
-    return {
-        first[1] * second[2] - first[2] * second[1],
-        first[2] * second[0] - first[0] * second[2],
-        first[0] * second[1] - first[1] * second[0]
-    };
+void RequestQuit() {
+    QuitRequested = true;
 }
 
-constexpr mat4 Mul(const mat4& first, const mat4& second) {
-    mat4 result{ 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
-
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            for (int k = 0; k < 4; k++) {
-                result[i][j] += static_cast<float>(first[i][k] * second[k][j]);
-            }
+// Main thread, key presses are dropped while the render thread is 256 events behind
+void PostPlatformEvent(const PlatformEvent& event) {
+    if(event.type == PlatformEventType::Resize) {
+        if(OverflowResize.load() != 0 || !PlatformEvents.Push(event)) {
+            OverflowResize = static_cast<std::uint64_t>(static_cast<std::uint32_t>(event.width)) << 32 | static_cast<std::uint32_t>(event.height);
         }
+        return;
     }
 
-    return result;
-}
-
-mat4 Perspective(float fov, float aspect, float near, float far) {
-    const float top = tan(ToRadians(fov) / 2.0f) * near;
-    const float right = top * aspect;
-
-    return {
-        near / right, 0.0f,       0.0f,                           0.0f,
-        0.0f,         near / top, 0.0f,                           0.0f,
-        0.0f,         0.0f,       -(far + near) / (far - near),   -1.0f,
-        0.0f,         0.0f,       -2 * far * near / (far - near), 0.0f
-    };
+    PlatformEvents.Push(event);
 }
 
-mat4 LookAt(const vec3& pos, const vec3& target, const vec3& up) {
-    const vec3 z_axis = Normalize({ pos[0] - target[0], pos[1] - target[1], pos[2] - target[2] });
-    const vec3 x_axis = Normalize(Cross(Normalize(up), z_axis));
-    const vec3 y_axis = Cross(z_axis, x_axis);
-
-    mat4 translation{
-        1.0f,    0.0f,    0.0f,    0.0f,
-        0.0f,    1.0f,    0.0f,    0.0f,
-        0.0f,    0.0f,    1.0f,    0.0f,
-        -pos[0], -pos[1], -pos[2], 1.0f
-    };
-
-    mat4 rotation{
-        x_axis[0], y_axis[0], z_axis[0], 0.0f,
-        x_axis[1], y_axis[1], z_axis[1], 0.0f,
-        x_axis[2], y_axis[2], z_axis[2], 0.0f,
-        0.0f,      0.0f,      0.0f,      1.0f
-    };
-
-    return Mul(translation, rotation);
-}
+#if defined(_WIN32)
+PFNWGLCHOOSEPIXELFORMATARBPROC wglChoosePixelFormatARB = nullptr;
+PFNWGLCREATECONTEXTATTRIBSARBPROC wglCreateContextAttribsARB = nullptr;
 
-constexpr mat4 Translate(const mat4& matrix, const vec3& vec) {
-    return {
-        matrix[0][0],          matrix[0][1],          matrix[0][2],          matrix[0][3],
-        matrix[1][0],          matrix[1][1],          matrix[1][2],          matrix[1][3],
-        matrix[2][0],          matrix[2][1],          matrix[2][2],          matrix[2][3],
-        matrix[3][0] + vec[0], matrix[3][1] + vec[1], matrix[3][2] + vec[2], matrix[3][3]
-    };
+void ReportError(const char* message) {
+    OutputDebugString(message);
+    OutputDebugString("\n");
 }
 
-constexpr mat4 Scale(const mat4& matrix, const vec3& vec) {
-    return {
-        matrix[0][0] * vec[0], matrix[0][1],          matrix[0][2],          matrix[0][3],
-        matrix[1][0],          matrix[1][1] * vec[1], matrix[1][2],          matrix[1][3],
-        matrix[2][0],          matrix[2][1],          matrix[2][2] * vec[2], matrix[2][3],
-        matrix[3][0],          matrix[3][1],          matrix[3][2],          matrix[3][3]
-    };
+void* GetOpenGLProcAddress(const char* name) {
+    return reinterpret_cast<void*>(wglGetProcAddress(name));
 }
 
+LRESULT CALLBACK WindowCallback(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam) {
+    switch(Msg) {
+        case WM_CLOSE:
+            PostQuitMessage(0);
+            break;
 
-/******************************************
- * Sources of shaders used in the program *
- ******************************************/
-const char* VertexShaderSource =
-"#version 330 core\n"
-"layout(location = 0) in vec3 aPos;\n"
-"layout(location = 1) in vec3 aColor;\n"
-"uniform mat4 model;\n"
-"uniform mat4 pv;\n"
-"out vec4 VertexColor;\n"
-"void main() {\n"
-"    VertexColor = vec4(aColor, 1.0);\n"
-"    gl_Position = pv * model * vec4(aPos, 1.0);\n"
-"}\n\0";
-
-const char* FragmentShaderSource =
-"#version 330 core\n"
-"in vec4 VertexColor;\n"
-"out vec4 FragColor;\n"
-"void main() {\n"
-"    FragColor = VertexColor;\n"
-"}\n\0";
+        case WM_SIZE:
+            PostPlatformEvent({ PlatformEventType::Resize, LOWORD(lParam), HIWORD(lParam) });
+            break;
 
+        case WM_KEYDOWN:
+            PostPlatformEvent({ PlatformEventType::Key, 0, 0, wParam == VK_ESCAPE ? PlatformKey::Escape : PlatformKey::Unknown });
+            break;
 
-/*************************
- * Constants and globals *
- *************************/
-constexpr int WindowWidth = 800;
-constexpr int WindowHeight = 600;
-constexpr GLfloat CubeVertices[] = {
-    // back
-    -0.5f, -0.5f, -0.5f,
-     0.5f, -0.5f, -0.5f,
-     0.5f,  0.5f, -0.5f,
-     0.5f,  0.5f, -0.5f,
-    -0.5f,  0.5f, -0.5f,
-    -0.5f, -0.5f, -0.5f,
-
-    // front
-    -0.5f, -0.5f,  0.5f,
-     0.5f, -0.5f,  0.5f,
-     0.5f,  0.5f,  0.5f,
-     0.5f,  0.5f,  0.5f,
-    -0.5f,  0.5f,  0.5f,
-    -0.5f, -0.5f,  0.5f,
-
-    // left
-    -0.5f,  0.5f,  0.5f,
-    -0.5f,  0.5f, -0.5f,
-    -0.5f, -0.5f, -0.5f,
-    -0.5f, -0.5f, -0.5f,
-    -0.5f, -0.5f,  0.5f,
-    -0.5f,  0.5f,  0.5f,
-
-    // right
-     0.5f,  0.5f,  0.5f,
-     0.5f,  0.5f, -0.5f,
-     0.5f, -0.5f, -0.5f,
-     0.5f, -0.5f, -0.5f,
-     0.5f, -0.5f,  0.5f,
-     0.5f,  0.5f,  0.5f,
-
-     // down
-     -0.5f, -0.5f, -0.5f,
-      0.5f, -0.5f, -0.5f,
-      0.5f, -0.5f,  0.5f,
-      0.5f, -0.5f,  0.5f,
-     -0.5f, -0.5f,  0.5f,
-     -0.5f, -0.5f, -0.5f,
-
-     // top
-     -0.5f,  0.5f, -0.5f,
-      0.5f,  0.5f, -0.5f,
-      0.5f,  0.5f,  0.5f,
-      0.5f,  0.5f,  0.5f,
-     -0.5f,  0.5f,  0.5f,
-     -0.5f,  0.5f, -0.5f
-};
+        default:
+            return DefWindowProc(hWnd, Msg, wParam, lParam);
+    }
 
+    return 0;
+}
 
-/***************************************
- * Visualizations forward declarations *
- ***************************************/
-void CubeWave(HDC deviceContext, GLuint shader_program);
-// void PenroseStairs(const Window* window, GLuint shader_program);
+bool CreatePlatformWindow(PlatformWindow& window, const char* title, int width, int height, bool headless) {
+    const HINSTANCE hInstance = GetModuleHandle(NULL);
+    window.width = width;
+    window.height = height;
+    window.headless = headless;
 
-INT WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, INT nCmdShow) {
     WNDCLASSEX wcex;
     ZeroMemory(&wcex, sizeof(wcex));
     wcex.cbSize = sizeof(wcex);
@@ -284,11 +199,11 @@ INT WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine,
 
     LPTSTR windowClass = MAKEINTATOM(RegisterClassEx(&wcex));
     if(!windowClass) {
-        OutputDebugString("Failed to register window class");
-        PostQuitMessage(0);
+        ReportError("Failed to register window class");
+        return false;
     }
 
-    // Fake ViewPort
+    // Fake ViewPort, needed only to load the WGL extensions creating the real context
     HWND fakeWindow = CreateWindowEx(
         0,                              // Optional window styles.
         windowClass,                    // Window class
@@ -305,6 +220,15 @@ INT WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine,
     );
 
     HDC fakeDeviceContext = GetDC(fakeWindow);
+    HGLRC fakeRenderContext = NULL;
+    auto destroyFakeViewport = [&]() {
+        wglMakeCurrent(NULL, NULL);
+        if(fakeRenderContext) {
+            wglDeleteContext(fakeRenderContext);
+        }
+        ReleaseDC(fakeWindow, fakeDeviceContext);
+        DestroyWindow(fakeWindow);
+    };
 
     PIXELFORMATDESCRIPTOR fakePixelFormatDescriptor{};
     ZeroMemory(&fakePixelFormatDescriptor, sizeof(fakePixelFormatDescriptor));
@@ -318,65 +242,57 @@ INT WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine,
 
     const int fakePixelFormatDescriptorID = ChoosePixelFormat(fakeDeviceContext, &fakePixelFormatDescriptor);
     if(fakePixelFormatDescriptorID == 0) {
-        OutputDebugString("Failed to choose fake pixel format");
-        PostQuitMessage(0);
+        ReportError("Failed to choose fake pixel format");
+        destroyFakeViewport();
+        return false;
     }
 
     if(!SetPixelFormat(fakeDeviceContext, fakePixelFormatDescriptorID, &fakePixelFormatDescriptor)) {
-        OutputDebugString("Failed to set fake pixel format");
-        PostQuitMessage(0);
+        ReportError("Failed to set fake pixel format");
+        destroyFakeViewport();
+        return false;
     }
 
-    HGLRC fakeRenderContext = wglCreateContext(fakeDeviceContext);
+    fakeRenderContext = wglCreateContext(fakeDeviceContext);
     if(fakeRenderContext == 0) {
-        OutputDebugString("Failed to set fake pixel format");
-        PostQuitMessage(0);
+        ReportError("Failed to create fake context");
+        destroyFakeViewport();
+        return false;
     }
 
     if(!wglMakeCurrent(fakeDeviceContext, fakeRenderContext)) {
-        OutputDebugString("Failed to set fake pixel format");
-        PostQuitMessage(0);
+        ReportError("Failed to make fake context current");
+        destroyFakeViewport();
+        return false;
     }
 
-    LoadOpenGLProc<PFNWGLCHOOSEPIXELFORMATARBPROC>(wglChoosePixelFormatARB, "wglChoosePixelFormatARB");
-    LoadOpenGLProc<PFNWGLCREATECONTEXTATTRIBSARBPROC>(wglCreateContextAttribsARB, "wglCreateContextAttribsARB");
-    LoadOpenGLProc<PFNGLCREATEPROGRAMPROC>(wglCreateProgram, "glCreateProgram");
-    LoadOpenGLProc<PFNGLATTACHSHADERPROC>(wglAttachShader, "glAttachShader");
-    LoadOpenGLProc<PFNGLLINKPROGRAMPROC>(wglLinkProgram, "glLinkProgram");
-    LoadOpenGLProc<PFNGLCREATESHADERPROC>(wglCreateShader, "glCreateShader");
-    LoadOpenGLProc<PFNGLSHADERSOURCEPROC>(wglShaderSource, "glShaderSource");
-    LoadOpenGLProc<PFNGLCOMPILESHADERPROC>(wglCompileShader, "glCompileShader");
-    LoadOpenGLProc<PFNGLDELETESHADERPROC>(wglDeleteShader, "glDeleteShader");
-    LoadOpenGLProc<PFNGLGENBUFFERSARBPROC>(wglGenBuffers, "glGenBuffers");
-    LoadOpenGLProc<PFNGLGENVERTEXARRAYSPROC>(wglGenVertexArrays, "glGenVertexArrays");
-    LoadOpenGLProc<PFNGLBINDVERTEXARRAYPROC>(wglBindVertexArray, "glBindVertexArray");
-    LoadOpenGLProc<PFNGLBUFFERDATAPROC>(wglBufferData, "glBufferData");
-    LoadOpenGLProc<PFNGLENABLEVERTEXATTRIBARRAYPROC>(wglEnableVertexAttribArray, "glEnableVertexAttribArray");
-    LoadOpenGLProc<PFNGLBINDBUFFERPROC>(wglBindBuffer, "glBindBuffer");
-    LoadOpenGLProc<PFNGLVERTEXATTRIBPOINTERPROC>(wglVertexAttribPointer, "glVertexAttribPointer");
-    LoadOpenGLProc<PFNGLGETUNIFORMLOCATIONPROC>(wglGetUniformLocation, "glGetUniformLocation");
-    LoadOpenGLProc<PFNGLUSEPROGRAMPROC>(wglUseProgram, "glUseProgram");
-    LoadOpenGLProc<PFNGLUNIFORMMATRIX4FVPROC>(wglUniformMatrix4fv, "glUniformMatrix4fv");
-    LoadOpenGLProc<PFNGLDELETEVERTEXARRAYSPROC>(wglDeleteVertexArrays, "glDeleteVertexArrays");
-    LoadOpenGLProc<PFNGLDELETEBUFFERSPROC>(wglDeleteBuffers, "glDeleteBuffers");
+    wglChoosePixelFormatARB = reinterpret_cast<PFNWGLCHOOSEPIXELFORMATARBPROC>(wglGetProcAddress("wglChoosePixelFormatARB"));
+    wglCreateContextAttribsARB = reinterpret_cast<PFNWGLCREATECONTEXTATTRIBSARBPROC>(wglGetProcAddress("wglCreateContextAttribsARB"));
+    if(!wglChoosePixelFormatARB || !wglCreateContextAttribsARB) {
+        ReportError("Failed to load WGL extensions");
+        destroyFakeViewport();
+        return false;
+    }
 
-    // Real viewport
-    HWND window = CreateWindowEx(
+    // Real viewport, sized so that its client area matches the requested size
+    RECT rect{ 0, 0, width, height };
+    AdjustWindowRect(&rect, WS_OVERLAPPEDWINDOW, FALSE);
+    window.handle = CreateWindowEx(
         0,                              // Optional window styles.
         windowClass,                    // Window class
-        "Cubes!",                       // Window text
+        title,                          // Window text
         WS_OVERLAPPEDWINDOW,            // Window style
 
         // Size and position
-        CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT,
+        CW_USEDEFAULT, CW_USEDEFAULT, rect.right - rect.left, rect.bottom - rect.top,
 
         NULL,       // Parent window
         NULL,       // Menu
-        hInstance,      // Instance handle
+        hInstance,  // Instance handle
         NULL        // Additional application data
     );
 
-    HDC deviceContext = GetDC(window);
+    window.device_context = GetDC(window.handle);
     constexpr int pixelAttribs[] = {
         WGL_DRAW_TO_WINDOW_ARB, GL_TRUE,
         WGL_SUPPORT_OPENGL_ARB, GL_TRUE,
@@ -394,15 +310,16 @@ INT WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine,
 
     int pixelFormatID;
     UINT numFormats;
-    const bool status = wglChoosePixelFormatARB(deviceContext, pixelAttribs, NULL, 1, &pixelFormatID, &numFormats);
+    const bool status = wglChoosePixelFormatARB(window.device_context, pixelAttribs, NULL, 1, &pixelFormatID, &numFormats);
     if(status == false || numFormats == 0) {
-        OutputDebugString("Failed to choose pixel format ARB");
-        PostQuitMessage(0);
+        ReportError("Failed to choose pixel format ARB");
+        destroyFakeViewport();
+        return false;
     }
 
     PIXELFORMATDESCRIPTOR pixelFormatDescriptor{};
-    DescribePixelFormat(deviceContext, pixelFormatID, sizeof(pixelFormatDescriptor), &pixelFormatDescriptor);
-    SetPixelFormat(deviceContext, pixelFormatID, &pixelFormatDescriptor);
+    DescribePixelFormat(window.device_context, pixelFormatID, sizeof(pixelFormatDescriptor), &pixelFormatDescriptor);
+    SetPixelFormat(window.device_context, pixelFormatID, &pixelFormatDescriptor);
 
     const int majorMin = 4;
     const int minorMin = 0;
@@ -413,278 +330,2763 @@ INT WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine,
             0
     };
 
-    HGLRC renderContext = wglCreateContextAttribsARB(deviceContext, 0, contextAttribs);
-    if(renderContext == NULL) {
-        OutputDebugString("Failed to create context");
-        PostQuitMessage(0);
+    window.render_context = wglCreateContextAttribsARB(window.device_context, 0, contextAttribs);
+    destroyFakeViewport();
+    if(window.render_context == NULL) {
+        ReportError("Failed to create context");
+        return false;
     }
 
-    SetWindowText(window, "Cubes!");
-    ShowWindow(window, nCmdShow);
+    if(!headless) {
+        ShowWindow(window.handle, SW_SHOW);
+    }
 
-    // Delete fake view
-    wglMakeCurrent(NULL, NULL);
-    wglDeleteContext(fakeRenderContext);
-    ReleaseDC(fakeWindow, fakeDeviceContext);
-    DestroyWindow(fakeWindow);
-    if(wglMakeCurrent(deviceContext, renderContext) == false) {
-        OutputDebugString("Failed to context current");
-        PostQuitMessage(0);
+    if(wglMakeCurrent(window.device_context, window.render_context) == false) {
+        ReportError("Failed to make context current");
+        return false;
     }
 
-    // Shader program
-    const GLuint vertex_shader = CreateShader(VertexShaderSource, GL_VERTEX_SHADER);
-    const GLuint fragment_shader = CreateShader(FragmentShaderSource, GL_FRAGMENT_SHADER);
-    const GLuint shader_program = CreateProgram(vertex_shader, fragment_shader);
-    wglDeleteShader(vertex_shader);
-    wglDeleteShader(fragment_shader);
+    return true;
+}
 
-    // Different scenes
-    switch(0) {
-        case 0:
-            CubeWave(deviceContext, shader_program);
-            break;
+// Main thread, waits up to timeout_ms for messages and dispatches them
+void PumpPlatformEvents(PlatformWindow& window, int timeout_ms) {
+    if(window.headless) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+        return;
+    }
 
-        case 1:
-            // PenroseStairs(&window, shader_program);
-            break;
+    PROFILE_ZONE("PumpPlatformEvents");
 
-        default:
-            break;
+    MsgWaitForMultipleObjects(0, NULL, FALSE, timeout_ms, QS_ALLINPUT);
+
+    MSG msg;
+    while(PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+        if(msg.message == WM_QUIT) {
+            RequestQuit();
+        }
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+}
+
+// Render thread, binds the context to the calling thread or releases it
+bool MakePlatformContextCurrent(PlatformWindow& window, bool current) {
+    if(current) {
+        return wglMakeCurrent(window.device_context, window.render_context) == TRUE;
     }
 
-    // End of application
+    return wglMakeCurrent(NULL, NULL) == TRUE;
+}
+
+void SwapPlatformBuffers(PlatformWindow& window) {
+    PROFILE_ZONE("SwapPlatformBuffers");
+    if(window.headless) {
+        glFlush();
+    } else {
+        SwapBuffers(window.device_context);
+    }
+}
+
+// Number of vertical blanks SwapPlatformBuffers waits for, WGL_EXT_swap_control
+bool SetPlatformSwapInterval(PlatformWindow& window, int interval) {
+    if(window.headless) {
+        return true;
+    }
+
+    const auto wglSwapIntervalEXT = reinterpret_cast<PFNWGLSWAPINTERVALEXTPROC>(wglGetProcAddress("wglSwapIntervalEXT"));
+    return wglSwapIntervalEXT != nullptr && wglSwapIntervalEXT(interval);
+}
+
+// Sleep granularity defaults to the 15.6ms system tick, precise raises it to 1ms while frames are paced
+void SetPlatformTimerResolution(bool precise) {
+    if(precise) {
+        timeBeginPeriod(1);
+    } else {
+        timeEndPeriod(1);
+    }
+}
+
+void DestroyPlatformWindow(PlatformWindow& window) {
     wglMakeCurrent(NULL, NULL);
-    if(renderContext) {
-        wglDeleteContext(renderContext);
+    if(window.render_context) {
+        wglDeleteContext(window.render_context);
     }
 
-    if(deviceContext) {
-        ReleaseDC(window, deviceContext);
+    if(window.device_context) {
+        ReleaseDC(window.handle, window.device_context);
     }
 
-    if(window) {
-        DestroyWindow(window);
+    if(window.handle) {
+        DestroyWindow(window.handle);
     }
 
-    return EXIT_SUCCESS;
+    window = PlatformWindow{};
+}
+#else
+void ReportError(const char* message) {
+    std::cerr << message << std::endl;
 }
 
-void CubeWave(HDC deviceContext, GLuint shader_program) {
-    constexpr int ROWS = 15;
-    constexpr int COLUMNS = 15;
-    constexpr float MIN_CUBE_HEIGHT = 5.0f;
-    constexpr float CUBE_HEIGHT_MULTIPLIER = 3.0f;
-    constexpr float SIN_MULTIPLIER = 2.0f;
+void* GetOpenGLProcAddress(const char* name) {
+    return reinterpret_cast<void*>(eglGetProcAddress(name));
+}
 
-    // Verticies
-    constexpr GLfloat colors[] = {
-        // back
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-
-        // front
-        0.0f,  0.0f,  0.18f,
-        0.0f,  0.0f,  0.18f,
-        0.0f,  0.0f,  0.18f,
-        0.0f,  0.0f,  0.18f,
-        0.0f,  0.0f,  0.18f,
-        0.0f,  0.0f,  0.18f,
-
-        // left
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-
-        // right
-        0.65f,  0.8f,  0.6f,
-        0.65f,  0.8f,  0.6f,
-        0.65f,  0.8f,  0.6f,
-        0.65f,  0.8f,  0.6f,
-        0.65f,  0.8f,  0.6f,
-        0.65f,  0.8f,  0.6f,
-
-        // down
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-
-        // top
-        0.4f,  0.6f,  0.65f,
-        0.4f,  0.6f,  0.65f,
-        0.4f,  0.6f,  0.65f,
-        0.4f,  0.6f,  0.65f,
-        0.4f,  0.6f,  0.65f,
-        0.4f,  0.6f,  0.65f
+// Context without any surface on the Mesa surfaceless platform, needs neither a display server nor a GPU
+bool CreateSurfacelessContext(PlatformWindow& window) {
+    const auto eglGetPlatformDisplayEXT = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if(!eglGetPlatformDisplayEXT) {
+        ReportError("Failed to load eglGetPlatformDisplayEXT");
+        return false;
+    }
+
+    window.egl_display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if(window.egl_display == EGL_NO_DISPLAY || !eglInitialize(window.egl_display, nullptr, nullptr)) {
+        ReportError("Failed to initialize surfaceless EGL display");
+        return false;
+    }
+
+    if(!eglBindAPI(EGL_OPENGL_API)) {
+        ReportError("Failed to bind OpenGL API");
+        return false;
+    }
+
+    constexpr EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
     };
 
-    // Buffer objects
-    GLuint vertex_buffer, color_buffer, vao;
-    wglGenBuffers(1, &vertex_buffer);
-    wglGenBuffers(1, &color_buffer);
-    wglGenVertexArrays(1, &vao);
-    
-    wglBindVertexArray(vao);
-    wglEnableVertexAttribArray(0);
-    wglEnableVertexAttribArray(1);
-    
-    wglBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-    wglBufferData(GL_ARRAY_BUFFER, sizeof(CubeVertices), CubeVertices, GL_STATIC_DRAW);
-    wglVertexAttribPointer(0, 3, GL_FLOAT, GL_TRUE, 0, (void*)0);
-    
-    wglBindBuffer(GL_ARRAY_BUFFER, color_buffer);
-    wglBufferData(GL_ARRAY_BUFFER, sizeof(colors), colors, GL_STATIC_DRAW);
-    wglVertexAttribPointer(1, 3, GL_FLOAT, GL_TRUE, 0, (void*)0);
-    
-    wglBindBuffer(GL_ARRAY_BUFFER, 0);
-    wglBindVertexArray(0);
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if(!eglChooseConfig(window.egl_display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+        ReportError("Failed to choose EGL config");
+        return false;
+    }
 
-    // Camera
-    const mat4 projection = Perspective(45.0f, static_cast<float>(WindowWidth / WindowHeight), 0.1f, 100.0f);
-    const mat4 view = LookAt(
-        { 20.0f, 22.5f, 20.0f },
-        { 0.0f, 0.0f, 0.0f },
-        { 0.0f, 1.0f, 0.0f }
-    );
+    constexpr EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 0,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
 
-    const mat4 pv = Mul(view, projection);
-    const GLint pv_loc = wglGetUniformLocation(shader_program, "pv");
+    window.context = eglCreateContext(window.egl_display, config, EGL_NO_CONTEXT, contextAttribs);
+    if(window.context == EGL_NO_CONTEXT) {
+        ReportError("Failed to create context");
+        return false;
+    }
 
-    // Load uniforms
-    wglUseProgram(shader_program);
-    wglUniformMatrix4fv(pv_loc, 1, GL_FALSE, &pv[0][0]);
+    if(!eglMakeCurrent(window.egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, window.context)) {
+        ReportError("Failed to make context current");
+        return false;
+    }
 
-    // OpenGL settings
-    glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-    glEnable(GL_DEPTH_TEST);
+    return true;
+}
 
-    MSG msg;
-    bool shouldCloseWindow = false;
-    while(shouldCloseWindow == false) {
-        while(PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
-            if(msg.message == WM_QUIT) {
-                shouldCloseWindow = true;
-            }
-            TranslateMessage(&msg);
-            DispatchMessage(&msg);
-        }
+// X11 window with an EGL context, Wayland sessions run it through XWayland
+bool CreatePlatformWindow(PlatformWindow& window, const char* title, int width, int height, bool headless) {
+    window.width = width;
+    window.height = height;
+    window.headless = headless;
+    if(headless) {
+        return CreateSurfacelessContext(window);
+    }
 
-        // Rendering
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // Render thread swaps through the same display connection the main thread pumps
+    XInitThreads();
+    window.display = XOpenDisplay(nullptr);
+    if(!window.display) {
+        ReportError("Failed to open X display");
+        return false;
+    }
 
-        wglUseProgram(shader_program);
-        wglBindVertexArray(vao);
-
-        const float time = GetTime(); // static_cast<float>(glfwGetTime());
-        for(int i = -ROWS / 2; i < ROWS / 2; ++i) {
-            for(int j = -COLUMNS / 2; j < COLUMNS / 2; ++j) {
-                const float distance_factor = static_cast<float>(sqrt(pow(i, 2) + pow(j, 2))) * 0.9f;
-                const float height = CUBE_HEIGHT_MULTIPLIER * sin(SIN_MULTIPLIER * time + distance_factor) + MIN_CUBE_HEIGHT;
-
-                mat4 model{
-                    1.0f, 0.0f, 0.0f, 0.0f,
-                    0.0f, 1.0f, 0.0f, 0.0f,
-                    0.0f, 0.0f, 1.0f, 0.0f,
-                    0.0f, 0.0f, 0.0f, 1.0f
-                };
-                model = Translate(model, { static_cast<float>(i), 0.0f, static_cast<float>(j) });
-                model = Scale(model, { 1.0f, height, 1.0f });
-                const GLint model_loc = wglGetUniformLocation(shader_program, "model");
-                wglUniformMatrix4fv(model_loc, 1, GL_FALSE, &model[0][0]);
-
-                glDrawArrays(GL_TRIANGLES, 0, 36);
-            }
-        }
+    window.egl_display = eglGetDisplay(reinterpret_cast<EGLNativeDisplayType>(window.display));
+    if(window.egl_display == EGL_NO_DISPLAY || !eglInitialize(window.egl_display, nullptr, nullptr)) {
+        ReportError("Failed to initialize EGL");
+        return false;
+    }
 
-        // Swap buffers
-        SwapBuffers(deviceContext);
+    if(!eglBindAPI(EGL_OPENGL_API)) {
+        ReportError("Failed to bind OpenGL API");
+        return false;
     }
 
-    // Free memory
-    wglDeleteVertexArrays(1, &vao);
-    wglDeleteBuffers(1, &vertex_buffer);
-    wglDeleteBuffers(1, &color_buffer);
-}
-
-
-/*void PenroseStairs(const Window* window, GLuint shader_program) {
-    constexpr GLfloat colors[] = {
-        // back
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-
-        // front
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-
-        // left
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-
-        // right
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-        0.37f, 0.0f,  0.73f,
-
-        // down
-        0.63f, 0.61f,  0.91f,
-        0.63f, 0.61f,  0.91f,
-        0.63f, 0.61f,  0.91f,
-        0.63f, 0.61f,  0.91f,
-        0.63f, 0.61f,  0.91f,
-        0.63f, 0.61f,  0.91f,
-
-        // top
-        0.63f, 0.61f,  0.91f,
-        0.63f, 0.61f,  0.91f,
-        0.63f, 0.61f,  0.91f,
-        0.63f, 0.61f,  0.91f,
-        0.63f, 0.61f,  0.91f,
-        0.63f, 0.61f,  0.91f
+    constexpr EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_STENCIL_SIZE, 8,
+        EGL_SAMPLE_BUFFERS, 1,
+        EGL_SAMPLES, 4,
+        EGL_NONE
     };
 
-    // Buffer objects
-    GLuint vertex_buffer, color_buffer, vao;
-    glGenBuffers(1, &vertex_buffer);
-    glGenBuffers(1, &color_buffer);
-    glGenVertexArrays(1, &vao);
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if(!eglChooseConfig(window.egl_display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+        ReportError("Failed to choose EGL config");
+        return false;
+    }
 
-    glBindVertexArray(vao);
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
+    // X11 window has to use the visual of the chosen config
+    EGLint visualID = 0;
+    eglGetConfigAttrib(window.egl_display, config, EGL_NATIVE_VISUAL_ID, &visualID);
+    XVisualInfo visualTemplate{};
+    visualTemplate.visualid = static_cast<VisualID>(visualID);
+    int numVisuals = 0;
+    XVisualInfo* visual = XGetVisualInfo(window.display, VisualIDMask, &visualTemplate, &numVisuals);
+    if(!visual) {
+        ReportError("Failed to get X visual");
+        return false;
+    }
 
-    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(CubeVertices), CubeVertices, GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_TRUE, 0, (void*)0);
+    const ::Window root = DefaultRootWindow(window.display);
+    window.colormap = XCreateColormap(window.display, root, visual->visual, AllocNone);
+
+    XSetWindowAttributes windowAttribs{};
+    windowAttribs.colormap = window.colormap;
+    windowAttribs.event_mask = StructureNotifyMask | KeyPressMask;
+    window.handle = XCreateWindow(
+        window.display, root,
+        0, 0, width, height, 0,
+        visual->depth, InputOutput, visual->visual,
+        CWColormap | CWEventMask, &windowAttribs
+    );
+    XFree(visual);
+
+    window.delete_message = XInternAtom(window.display, "WM_DELETE_WINDOW", False);
+    XSetWMProtocols(window.display, window.handle, &window.delete_message, 1);
+    XStoreName(window.display, window.handle, title);
+    XMapWindow(window.display, window.handle);
+
+    window.surface = eglCreateWindowSurface(window.egl_display, config, static_cast<EGLNativeWindowType>(window.handle), nullptr);
+    if(window.surface == EGL_NO_SURFACE) {
+        ReportError("Failed to create EGL surface");
+        return false;
+    }
+
+    constexpr EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 0,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+
+    window.context = eglCreateContext(window.egl_display, config, EGL_NO_CONTEXT, contextAttribs);
+    if(window.context == EGL_NO_CONTEXT) {
+        ReportError("Failed to create context");
+        return false;
+    }
+
+    if(!eglMakeCurrent(window.egl_display, window.surface, window.surface, window.context)) {
+        ReportError("Failed to make context current");
+        return false;
+    }
+
+    return true;
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, color_buffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(colors), colors, GL_STATIC_DRAW);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_TRUE, 0, (void*)0);
+// Main thread, waits up to timeout_ms for events and dispatches them
+void PumpPlatformEvents(PlatformWindow& window, int timeout_ms) {
+    if(window.headless) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+        return;
+    }
+
+    PROFILE_ZONE("PumpPlatformEvents");
+
+    if(!XPending(window.display)) {
+        pollfd connection{ ConnectionNumber(window.display), POLLIN, 0 };
+        poll(&connection, 1, timeout_ms);
+    }
+
+    while(XPending(window.display)) {
+        XEvent event;
+        XNextEvent(window.display, &event);
+        if(event.type == ClientMessage && static_cast<Atom>(event.xclient.data.l[0]) == window.delete_message) {
+            RequestQuit();
+        } else if(event.type == ConfigureNotify) {
+            PostPlatformEvent({ PlatformEventType::Resize, event.xconfigure.width, event.xconfigure.height });
+        } else if(event.type == KeyPress) {
+            const KeySym symbol = XLookupKeysym(&event.xkey, 0);
+            PostPlatformEvent({ PlatformEventType::Key, 0, 0, symbol == XK_Escape ? PlatformKey::Escape : PlatformKey::Unknown });
+        }
+    }
+}
+
+// Render thread, binds the context to the calling thread or releases it
+bool MakePlatformContextCurrent(PlatformWindow& window, bool current) {
+    if(current) {
+        return eglMakeCurrent(window.egl_display, window.surface, window.surface, window.context) == EGL_TRUE;
+    }
+
+    return eglMakeCurrent(window.egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT) == EGL_TRUE;
+}
+
+void SwapPlatformBuffers(PlatformWindow& window) {
+    PROFILE_ZONE("SwapPlatformBuffers");
+    if(window.headless) {
+        glFlush();
+    } else {
+        eglSwapBuffers(window.egl_display, window.surface);
+    }
+}
+
+// Number of vertical blanks SwapPlatformBuffers waits for
+bool SetPlatformSwapInterval(PlatformWindow& window, int interval) {
+    if(window.headless) {
+        return true;
+    }
+
+    return eglSwapInterval(window.egl_display, interval) == EGL_TRUE;
+}
+
+// Sleeps on Linux are already precise
+void SetPlatformTimerResolution(bool /*precise*/) {
+}
+
+void DestroyPlatformWindow(PlatformWindow& window) {
+    if(window.egl_display != EGL_NO_DISPLAY) {
+        eglMakeCurrent(window.egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if(window.context != EGL_NO_CONTEXT) {
+            eglDestroyContext(window.egl_display, window.context);
+        }
+
+        if(window.surface != EGL_NO_SURFACE) {
+            eglDestroySurface(window.egl_display, window.surface);
+        }
+
+        eglTerminate(window.egl_display);
+    }
+
+    if(window.display) {
+        if(window.handle) {
+            XDestroyWindow(window.display, window.handle);
+        }
+
+        if(window.colormap) {
+            XFreeColormap(window.display, window.colormap);
+        }
+
+        XCloseDisplay(window.display);
+    }
+
+    window = PlatformWindow{};
+}
+#endif
+
+void ResizePlatformWindow(PlatformWindow& window, int width, int height) {
+    if(width > 0 && height > 0) {
+        window.width = width;
+        window.height = height;
+        glViewport(0, 0, window.width, window.height);
+    }
+}
+
+// Render thread, applies events forwarded by the main thread, returns false once the application should quit.
+// Escape quits.
+bool PollPlatformEvents(PlatformWindow& window) {
+    PROFILE_ZONE("PollPlatformEvents");
+    PlatformEvent event;
+    while(PlatformEvents.Pop(event)) {
+        if(event.type == PlatformEventType::Resize) {
+            ResizePlatformWindow(window, event.width, event.height);
+        } else if(event.type == PlatformEventType::Key && event.key == PlatformKey::Escape) {
+            RequestQuit();
+        }
+    }
+
+    // Sizes that overflowed the queue are newer than any queued one
+    const std::uint64_t size = OverflowResize.exchange(0);
+    if(size != 0) {
+        ResizePlatformWindow(window, static_cast<int>(size >> 32), static_cast<int>(size & 0xFFFFFFFFu));
+    }
+
+    return !QuitRequested;
+}
+
+
+/********************************
+ * OpenGL utilities and helpers *
+ ********************************/
+template <class T>
+bool TryLoadOpenGLProc(T& procPointer, const char* name) {
+    procPointer = reinterpret_cast<T>(GetOpenGLProcAddress(name));
+    return procPointer != nullptr;
+}
+
+ template <class T>
+ void LoadOpenGLProc(T& procPointer, const char* name) {
+    if(!TryLoadOpenGLProc(procPointer, name)) {
+        ReportError("Failed to load function:");
+        ReportError(name);
+        RequestQuit();
+    }
+ }
+
+PFNGLCREATEPROGRAMPROC wglCreateProgram = nullptr;
+PFNGLATTACHSHADERPROC wglAttachShader = nullptr;
+PFNGLLINKPROGRAMPROC wglLinkProgram = nullptr;
+PFNGLCREATESHADERPROC wglCreateShader = nullptr;
+PFNGLSHADERSOURCEPROC wglShaderSource = nullptr;
+PFNGLCOMPILESHADERPROC wglCompileShader = nullptr;
+PFNGLDELETESHADERPROC wglDeleteShader = nullptr;
+PFNGLGENBUFFERSARBPROC wglGenBuffers = nullptr;
+PFNGLGENVERTEXARRAYSPROC wglGenVertexArrays = nullptr;
+PFNGLBINDVERTEXARRAYPROC wglBindVertexArray = nullptr;
+PFNGLBUFFERDATAPROC wglBufferData = nullptr;
+PFNGLENABLEVERTEXATTRIBARRAYPROC wglEnableVertexAttribArray = nullptr;
+PFNGLBINDBUFFERPROC wglBindBuffer = nullptr;
+PFNGLVERTEXATTRIBPOINTERPROC wglVertexAttribPointer = nullptr;
+PFNGLGETUNIFORMLOCATIONPROC wglGetUniformLocation = nullptr;
+PFNGLUSEPROGRAMPROC wglUseProgram = nullptr;
+PFNGLUNIFORMMATRIX4FVPROC wglUniformMatrix4fv = nullptr;
+PFNGLUNIFORM1FPROC wglUniform1f = nullptr;
+PFNGLUNIFORM1IPROC wglUniform1i = nullptr;
+PFNGLUNIFORM2IPROC wglUniform2i = nullptr;
+PFNGLUNIFORM3FVPROC wglUniform3fv = nullptr;
+PFNGLUNIFORM4FVPROC wglUniform4fv = nullptr;
+PFNGLGETPROGRAMIVPROC wglGetProgramiv = nullptr;
+PFNGLGETACTIVEUNIFORMPROC wglGetActiveUniform = nullptr;
+PFNGLGETACTIVEATTRIBPROC wglGetActiveAttrib = nullptr;
+PFNGLGETATTRIBLOCATIONPROC wglGetAttribLocation = nullptr;
+PFNGLGETACTIVEUNIFORMBLOCKNAMEPROC wglGetActiveUniformBlockName = nullptr;
+PFNGLUNIFORMBLOCKBINDINGPROC wglUniformBlockBinding = nullptr;
+PFNGLBINDBUFFERBASEPROC wglBindBufferBase = nullptr;
+PFNGLBUFFERSUBDATAPROC wglBufferSubData = nullptr;
+PFNGLFENCESYNCPROC wglFenceSync = nullptr;
+PFNGLCLIENTWAITSYNCPROC wglClientWaitSync = nullptr;
+PFNGLDELETESYNCPROC wglDeleteSync = nullptr;
+PFNGLMAPBUFFERRANGEPROC wglMapBufferRange = nullptr;
+PFNGLUNMAPBUFFERPROC wglUnmapBuffer = nullptr;
+PFNGLDELETEVERTEXARRAYSPROC wglDeleteVertexArrays = nullptr;
+PFNGLDELETEBUFFERSPROC wglDeleteBuffers = nullptr;
+PFNGLDRAWELEMENTSINSTANCEDPROC wglDrawElementsInstanced = nullptr;
+PFNGLVERTEXATTRIBDIVISORPROC wglVertexAttribDivisor = nullptr;
+PFNGLGENFRAMEBUFFERSPROC wglGenFramebuffers = nullptr;
+PFNGLBINDFRAMEBUFFERPROC wglBindFramebuffer = nullptr;
+PFNGLDELETEFRAMEBUFFERSPROC wglDeleteFramebuffers = nullptr;
+PFNGLFRAMEBUFFERRENDERBUFFERPROC wglFramebufferRenderbuffer = nullptr;
+PFNGLCHECKFRAMEBUFFERSTATUSPROC wglCheckFramebufferStatus = nullptr;
+PFNGLBLITFRAMEBUFFERPROC wglBlitFramebuffer = nullptr;
+PFNGLGENRENDERBUFFERSPROC wglGenRenderbuffers = nullptr;
+PFNGLBINDRENDERBUFFERPROC wglBindRenderbuffer = nullptr;
+PFNGLDELETERENDERBUFFERSPROC wglDeleteRenderbuffers = nullptr;
+PFNGLRENDERBUFFERSTORAGEMULTISAMPLEPROC wglRenderbufferStorageMultisample = nullptr;
+PFNGLGENQUERIESPROC wglGenQueries = nullptr;
+PFNGLDELETEQUERIESPROC wglDeleteQueries = nullptr;
+PFNGLBEGINQUERYPROC wglBeginQuery = nullptr;
+PFNGLENDQUERYPROC wglEndQuery = nullptr;
+PFNGLGETQUERYOBJECTUI64VPROC wglGetQueryObjectui64v = nullptr;
+PFNGLGETQUERYOBJECTIVPROC wglGetQueryObjectiv = nullptr;
+PFNGLQUERYCOUNTERPROC wglQueryCounter = nullptr;
+PFNGLDELETEPROGRAMPROC wglDeleteProgram = nullptr;
+PFNGLDRAWELEMENTSINDIRECTPROC wglDrawElementsIndirect = nullptr;
+PFNGLTRANSFORMFEEDBACKVARYINGSPROC wglTransformFeedbackVaryings = nullptr;
+PFNGLGENTRANSFORMFEEDBACKSPROC wglGenTransformFeedbacks = nullptr;
+PFNGLDELETETRANSFORMFEEDBACKSPROC wglDeleteTransformFeedbacks = nullptr;
+PFNGLBINDTRANSFORMFEEDBACKPROC wglBindTransformFeedback = nullptr;
+PFNGLBEGINTRANSFORMFEEDBACKPROC wglBeginTransformFeedback = nullptr;
+PFNGLENDTRANSFORMFEEDBACKPROC wglEndTransformFeedback = nullptr;
+PFNGLDRAWTRANSFORMFEEDBACKPROC wglDrawTransformFeedback = nullptr;
+PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC wglMultiDrawElementsBaseVertex = nullptr;
+PFNGLBUFFERSTORAGEPROC wglBufferStorage = nullptr; // Optional, OpenGL 4.4
+PFNGLDISPATCHCOMPUTEPROC wglDispatchCompute = nullptr; // Optional, OpenGL 4.3
+PFNGLMEMORYBARRIERPROC wglMemoryBarrier = nullptr; // Optional, OpenGL 4.2
+
+// Version of the created context, queried once it is made current
+GLint OpenGLMajorVersion = 0;
+GLint OpenGLMinorVersion = 0;
+
+bool HasOpenGLVersion(GLint major, GLint minor) {
+    return OpenGLMajorVersion > major || (OpenGLMajorVersion == major && OpenGLMinorVersion >= minor);
+}
+
+// Loads functions of the current context and queries its version
+void LoadOpenGLProcs() {
+    LoadOpenGLProc<PFNGLCREATEPROGRAMPROC>(wglCreateProgram, "glCreateProgram");
+    LoadOpenGLProc<PFNGLATTACHSHADERPROC>(wglAttachShader, "glAttachShader");
+    LoadOpenGLProc<PFNGLLINKPROGRAMPROC>(wglLinkProgram, "glLinkProgram");
+    LoadOpenGLProc<PFNGLCREATESHADERPROC>(wglCreateShader, "glCreateShader");
+    LoadOpenGLProc<PFNGLSHADERSOURCEPROC>(wglShaderSource, "glShaderSource");
+    LoadOpenGLProc<PFNGLCOMPILESHADERPROC>(wglCompileShader, "glCompileShader");
+    LoadOpenGLProc<PFNGLDELETESHADERPROC>(wglDeleteShader, "glDeleteShader");
+    LoadOpenGLProc<PFNGLGENBUFFERSARBPROC>(wglGenBuffers, "glGenBuffers");
+    LoadOpenGLProc<PFNGLGENVERTEXARRAYSPROC>(wglGenVertexArrays, "glGenVertexArrays");
+    LoadOpenGLProc<PFNGLBINDVERTEXARRAYPROC>(wglBindVertexArray, "glBindVertexArray");
+    LoadOpenGLProc<PFNGLBUFFERDATAPROC>(wglBufferData, "glBufferData");
+    LoadOpenGLProc<PFNGLENABLEVERTEXATTRIBARRAYPROC>(wglEnableVertexAttribArray, "glEnableVertexAttribArray");
+    LoadOpenGLProc<PFNGLBINDBUFFERPROC>(wglBindBuffer, "glBindBuffer");
+    LoadOpenGLProc<PFNGLVERTEXATTRIBPOINTERPROC>(wglVertexAttribPointer, "glVertexAttribPointer");
+    LoadOpenGLProc<PFNGLGETUNIFORMLOCATIONPROC>(wglGetUniformLocation, "glGetUniformLocation");
+    LoadOpenGLProc<PFNGLUSEPROGRAMPROC>(wglUseProgram, "glUseProgram");
+    LoadOpenGLProc<PFNGLUNIFORMMATRIX4FVPROC>(wglUniformMatrix4fv, "glUniformMatrix4fv");
+    LoadOpenGLProc<PFNGLUNIFORM1FPROC>(wglUniform1f, "glUniform1f");
+    LoadOpenGLProc<PFNGLUNIFORM1IPROC>(wglUniform1i, "glUniform1i");
+    LoadOpenGLProc<PFNGLUNIFORM2IPROC>(wglUniform2i, "glUniform2i");
+    LoadOpenGLProc<PFNGLUNIFORM3FVPROC>(wglUniform3fv, "glUniform3fv");
+    LoadOpenGLProc<PFNGLUNIFORM4FVPROC>(wglUniform4fv, "glUniform4fv");
+    LoadOpenGLProc<PFNGLGETPROGRAMIVPROC>(wglGetProgramiv, "glGetProgramiv");
+    LoadOpenGLProc<PFNGLGETACTIVEUNIFORMPROC>(wglGetActiveUniform, "glGetActiveUniform");
+    LoadOpenGLProc<PFNGLGETACTIVEATTRIBPROC>(wglGetActiveAttrib, "glGetActiveAttrib");
+    LoadOpenGLProc<PFNGLGETATTRIBLOCATIONPROC>(wglGetAttribLocation, "glGetAttribLocation");
+    LoadOpenGLProc<PFNGLGETACTIVEUNIFORMBLOCKNAMEPROC>(wglGetActiveUniformBlockName, "glGetActiveUniformBlockName");
+    LoadOpenGLProc<PFNGLUNIFORMBLOCKBINDINGPROC>(wglUniformBlockBinding, "glUniformBlockBinding");
+    LoadOpenGLProc<PFNGLBINDBUFFERBASEPROC>(wglBindBufferBase, "glBindBufferBase");
+    LoadOpenGLProc<PFNGLBUFFERSUBDATAPROC>(wglBufferSubData, "glBufferSubData");
+    LoadOpenGLProc<PFNGLFENCESYNCPROC>(wglFenceSync, "glFenceSync");
+    LoadOpenGLProc<PFNGLCLIENTWAITSYNCPROC>(wglClientWaitSync, "glClientWaitSync");
+    LoadOpenGLProc<PFNGLDELETESYNCPROC>(wglDeleteSync, "glDeleteSync");
+    LoadOpenGLProc<PFNGLMAPBUFFERRANGEPROC>(wglMapBufferRange, "glMapBufferRange");
+    LoadOpenGLProc<PFNGLUNMAPBUFFERPROC>(wglUnmapBuffer, "glUnmapBuffer");
+    LoadOpenGLProc<PFNGLDELETEVERTEXARRAYSPROC>(wglDeleteVertexArrays, "glDeleteVertexArrays");
+    LoadOpenGLProc<PFNGLDELETEBUFFERSPROC>(wglDeleteBuffers, "glDeleteBuffers");
+    LoadOpenGLProc<PFNGLDRAWELEMENTSINSTANCEDPROC>(wglDrawElementsInstanced, "glDrawElementsInstanced");
+    LoadOpenGLProc<PFNGLVERTEXATTRIBDIVISORPROC>(wglVertexAttribDivisor, "glVertexAttribDivisor");
+    LoadOpenGLProc<PFNGLGENFRAMEBUFFERSPROC>(wglGenFramebuffers, "glGenFramebuffers");
+    LoadOpenGLProc<PFNGLBINDFRAMEBUFFERPROC>(wglBindFramebuffer, "glBindFramebuffer");
+    LoadOpenGLProc<PFNGLDELETEFRAMEBUFFERSPROC>(wglDeleteFramebuffers, "glDeleteFramebuffers");
+    LoadOpenGLProc<PFNGLFRAMEBUFFERRENDERBUFFERPROC>(wglFramebufferRenderbuffer, "glFramebufferRenderbuffer");
+    LoadOpenGLProc<PFNGLCHECKFRAMEBUFFERSTATUSPROC>(wglCheckFramebufferStatus, "glCheckFramebufferStatus");
+    LoadOpenGLProc<PFNGLBLITFRAMEBUFFERPROC>(wglBlitFramebuffer, "glBlitFramebuffer");
+    LoadOpenGLProc<PFNGLGENRENDERBUFFERSPROC>(wglGenRenderbuffers, "glGenRenderbuffers");
+    LoadOpenGLProc<PFNGLBINDRENDERBUFFERPROC>(wglBindRenderbuffer, "glBindRenderbuffer");
+    LoadOpenGLProc<PFNGLDELETERENDERBUFFERSPROC>(wglDeleteRenderbuffers, "glDeleteRenderbuffers");
+    LoadOpenGLProc<PFNGLRENDERBUFFERSTORAGEMULTISAMPLEPROC>(wglRenderbufferStorageMultisample, "glRenderbufferStorageMultisample");
+    LoadOpenGLProc<PFNGLGENQUERIESPROC>(wglGenQueries, "glGenQueries");
+    LoadOpenGLProc<PFNGLDELETEQUERIESPROC>(wglDeleteQueries, "glDeleteQueries");
+    LoadOpenGLProc<PFNGLBEGINQUERYPROC>(wglBeginQuery, "glBeginQuery");
+    LoadOpenGLProc<PFNGLENDQUERYPROC>(wglEndQuery, "glEndQuery");
+    LoadOpenGLProc<PFNGLGETQUERYOBJECTUI64VPROC>(wglGetQueryObjectui64v, "glGetQueryObjectui64v");
+    LoadOpenGLProc<PFNGLGETQUERYOBJECTIVPROC>(wglGetQueryObjectiv, "glGetQueryObjectiv");
+    LoadOpenGLProc<PFNGLQUERYCOUNTERPROC>(wglQueryCounter, "glQueryCounter");
+    LoadOpenGLProc<PFNGLDELETEPROGRAMPROC>(wglDeleteProgram, "glDeleteProgram");
+    LoadOpenGLProc<PFNGLDRAWELEMENTSINDIRECTPROC>(wglDrawElementsIndirect, "glDrawElementsIndirect");
+    LoadOpenGLProc<PFNGLTRANSFORMFEEDBACKVARYINGSPROC>(wglTransformFeedbackVaryings, "glTransformFeedbackVaryings");
+    LoadOpenGLProc<PFNGLGENTRANSFORMFEEDBACKSPROC>(wglGenTransformFeedbacks, "glGenTransformFeedbacks");
+    LoadOpenGLProc<PFNGLDELETETRANSFORMFEEDBACKSPROC>(wglDeleteTransformFeedbacks, "glDeleteTransformFeedbacks");
+    LoadOpenGLProc<PFNGLBINDTRANSFORMFEEDBACKPROC>(wglBindTransformFeedback, "glBindTransformFeedback");
+    LoadOpenGLProc<PFNGLBEGINTRANSFORMFEEDBACKPROC>(wglBeginTransformFeedback, "glBeginTransformFeedback");
+    LoadOpenGLProc<PFNGLENDTRANSFORMFEEDBACKPROC>(wglEndTransformFeedback, "glEndTransformFeedback");
+    LoadOpenGLProc<PFNGLDRAWTRANSFORMFEEDBACKPROC>(wglDrawTransformFeedback, "glDrawTransformFeedback");
+    LoadOpenGLProc<PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC>(wglMultiDrawElementsBaseVertex, "glMultiDrawElementsBaseVertex");
+    TryLoadOpenGLProc<PFNGLBUFFERSTORAGEPROC>(wglBufferStorage, "glBufferStorage");
+    TryLoadOpenGLProc<PFNGLDISPATCHCOMPUTEPROC>(wglDispatchCompute, "glDispatchCompute");
+    TryLoadOpenGLProc<PFNGLMEMORYBARRIERPROC>(wglMemoryBarrier, "glMemoryBarrier");
+
+    glGetIntegerv(GL_MAJOR_VERSION, &OpenGLMajorVersion);
+    glGetIntegerv(GL_MINOR_VERSION, &OpenGLMinorVersion);
+}
+
+GLuint CreateShader(const char* source, GLenum shader_type) {
+    const GLuint shader = wglCreateShader(shader_type);
+    wglShaderSource(shader, 1, &source, nullptr);
+    wglCompileShader(shader);
+    return shader;
+}
+
+// Sources are concatenated in order, the first one holds the #version line
+GLuint CreateShader(std::initializer_list<const char*> sources, GLenum shader_type) {
+    const GLuint shader = wglCreateShader(shader_type);
+    wglShaderSource(shader, static_cast<GLsizei>(sources.size()), sources.begin(), nullptr);
+    wglCompileShader(shader);
+    return shader;
+}
+
+GLuint CreateProgram(GLuint vertex_shader, GLuint fragment_shader) {
+    const GLuint program = wglCreateProgram();
+    wglAttachShader(program, vertex_shader);
+    wglAttachShader(program, fragment_shader);
+    wglLinkProgram(program);
+    return program;
+}
+
+// Links any set of stages, varyings are captured interleaved into transform feedback buffer 0
+GLuint CreateProgram(std::initializer_list<GLuint> shaders, std::initializer_list<const char*> varyings = {}) {
+    const GLuint program = wglCreateProgram();
+    for(GLuint shader : shaders) {
+        wglAttachShader(program, shader);
+    }
+    if(varyings.size() > 0) {
+        wglTransformFeedbackVaryings(program, static_cast<GLsizei>(varyings.size()), varyings.begin(), GL_INTERLEAVED_ATTRIBS);
+    }
+    wglLinkProgram(program);
+    return program;
+}
+
+// Active uniforms, attributes and uniform blocks of a linked program, queried once
+struct ProgramReflection {
+    GLuint program = 0;
+    std::unordered_map<std::string, GLint> uniforms;
+    std::unordered_map<std::string, GLint> attributes;
+    std::unordered_map<std::string, GLuint> uniform_blocks;
+
+    GLint Uniform(const std::string& name) const {
+        const auto it = uniforms.find(name);
+        return it != uniforms.end() ? it->second : -1;
+    }
+
+    GLint Attribute(const std::string& name) const {
+        const auto it = attributes.find(name);
+        return it != attributes.end() ? it->second : -1;
+    }
+
+    // Connects the block to the binding point, does nothing if the program does not use the block
+    void BindUniformBlock(const std::string& name, GLuint binding) const {
+        const auto it = uniform_blocks.find(name);
+        if(it != uniform_blocks.end()) {
+            wglUniformBlockBinding(program, it->second, binding);
+        }
+    }
+};
+
+ProgramReflection ReflectProgram(GLuint program) {
+    ProgramReflection reflection;
+    reflection.program = program;
+
+    // Array names are reported as "name[0]", they are stored without the subscript
+    auto strip_array = [](const GLchar* name, GLsizei length) {
+        std::string result(name, length);
+        const std::size_t subscript = result.find('[');
+        if(subscript != std::string::npos) {
+            result.erase(subscript);
+        }
+        return result;
+    };
+
+    GLint count = 0;
+    GLint max_length = 0;
+    GLsizei length = 0;
+    GLint size = 0;
+    GLenum type = 0;
+
+    wglGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    wglGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+    std::vector<GLchar> name(static_cast<std::size_t>(max_length) + 1);
+    for(GLint i = 0; i < count; i++) {
+        wglGetActiveUniform(program, i, static_cast<GLsizei>(name.size()), &length, &size, &type, name.data());
+        const GLint location = wglGetUniformLocation(program, name.data());
+
+        // Members of uniform blocks have no location
+        if(location != -1) {
+            reflection.uniforms[strip_array(name.data(), length)] = location;
+        }
+    }
+
+    wglGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+    wglGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_length);
+    name.resize(static_cast<std::size_t>(max_length) + 1);
+    for(GLint i = 0; i < count; i++) {
+        wglGetActiveAttrib(program, i, static_cast<GLsizei>(name.size()), &length, &size, &type, name.data());
+        reflection.attributes[strip_array(name.data(), length)] = wglGetAttribLocation(program, name.data());
+    }
+
+    wglGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+    wglGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &max_length);
+    name.resize(static_cast<std::size_t>(max_length) + 1);
+    for(GLint i = 0; i < count; i++) {
+        wglGetActiveUniformBlockName(program, i, static_cast<GLsizei>(name.size()), &length, name.data());
+        reflection.uniform_blocks[std::string(name.data(), length)] = i;
+    }
+
+    return reflection;
+}
+
+// Shadow of the state set through it, calls that would not change the current value are dropped.
+// Buffers and vertex arrays it tracks have to be bound and deleted through it, otherwise the
+// shadow goes stale. Only the thread owning the context may use it.
+struct RenderStateCache {
+    GLuint program = 0;
+    GLuint vertex_array = 0;
+    std::unordered_map<GLenum, GLuint> buffers;     // Targets missing from the map are unknown
+    std::unordered_map<GLenum, bool> capabilities;
+    std::array<GLfloat, 4> clear_color{};
+    long issued = 0;                                // Calls passed to the GL
+    long elided = 0;                                // Calls dropped as redundant
+
+    void UseProgram(GLuint value) {
+        if(Changes(program, value)) {
+            wglUseProgram(value);
+        }
+    }
+
+    // Element array binding belongs to the vertex array, it is unknown after a switch
+    void BindVertexArray(GLuint value) {
+        if(Changes(vertex_array, value)) {
+            wglBindVertexArray(value);
+            buffers.erase(GL_ELEMENT_ARRAY_BUFFER);
+        }
+    }
+
+    void BindBuffer(GLenum target, GLuint buffer) {
+        if(Changes(buffers, target, buffer)) {
+            wglBindBuffer(target, buffer);
+        }
+    }
+
+    // Binding an indexed target also binds its generic binding point
+    void BindBufferBase(GLenum target, GLuint index, GLuint buffer) {
+        issued++;
+        wglBindBufferBase(target, index, buffer);
+        buffers[target] = buffer;
+    }
+
+    void Enable(GLenum capability) {
+        if(Changes(capabilities, capability, true)) {
+            glEnable(capability);
+        }
+    }
+
+    void Disable(GLenum capability) {
+        if(Changes(capabilities, capability, false)) {
+            glDisable(capability);
+        }
+    }
+
+    void ClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha) {
+        if(Changes(clear_color, { red, green, blue, alpha })) {
+            glClearColor(red, green, blue, alpha);
+        }
+    }
+
+    // Deleting a bound object reverts its bindings to 0
+    void DeleteBuffer(GLuint buffer) {
+        wglDeleteBuffers(1, &buffer);
+        for(auto& binding : buffers) {
+            if(binding.second == buffer) {
+                binding.second = 0;
+            }
+        }
+    }
+
+    void DeleteVertexArray(GLuint value) {
+        wglDeleteVertexArrays(1, &value);
+        if(vertex_array == value) {
+            vertex_array = 0;
+            buffers.erase(GL_ELEMENT_ARRAY_BUFFER);
+        }
+    }
+
+    // Stores the new value and counts the call, returns whether it has to be issued
+    template <class T>
+    bool Changes(T& current, const T& value) {
+        if(current == value) {
+            elided++;
+            return false;
+        }
+        current = value;
+        issued++;
+        return true;
+    }
+
+    template <class T>
+    bool Changes(std::unordered_map<GLenum, T>& values, GLenum key, T value) {
+        const auto it = values.find(key);
+        if(it != values.end() && it->second == value) {
+            elided++;
+            return false;
+        }
+        values[key] = value;
+        issued++;
+        return true;
+    }
+};
+
+RenderStateCache RenderState;
+
+// Attribute interleaved in a vertex, type and normalization follow glVertexAttribPointer
+struct VertexAttribute {
+    GLuint location;
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    std::size_t offset;
+};
+
+// Attributes sharing one buffer, advanced per vertex (divisor 0) or per divisor instances
+struct VertexLayout {
+    GLsizei stride;
+    GLuint divisor;
+    std::vector<VertexAttribute> attributes;
+};
+
+// Points attributes of the bound vertex array at the buffer bound to GL_ARRAY_BUFFER, starting base bytes into it
+void ApplyVertexLayout(const VertexLayout& layout, GLintptr base = 0) {
+    for(const VertexAttribute& attribute : layout.attributes) {
+        wglEnableVertexAttribArray(attribute.location);
+        wglVertexAttribPointer(attribute.location, attribute.size, attribute.type, attribute.normalized, layout.stride, (void*)(base + attribute.offset));
+        wglVertexAttribDivisor(attribute.location, layout.divisor);
+    }
+}
+
+// Buffer split into regions that the CPU fills while the GPU still reads the previous ones.
+// With glBufferStorage the regions are persistently mapped and written in place, otherwise
+// they are staged in client memory and uploaded with glBufferSubData. Each region is
+// guarded by a fence, so the CPU waits only if it laps the GPU.
+struct StreamBuffer {
+    static constexpr int Regions = 3;
+
+    GLuint buffer = 0;
+    GLenum target = 0;
+    GLsizeiptr region_size = 0;
+    std::array<GLsync, Regions> fences{};
+    unsigned char* mapped = nullptr;
+    std::vector<unsigned char> staging;
+
+    GLintptr Offset(int region) const {
+        return region * region_size;
+    }
+};
+
+StreamBuffer CreateStreamBuffer(GLenum target, GLsizeiptr region_size) {
+    StreamBuffer stream;
+    stream.target = target;
+    stream.region_size = region_size;
+
+    const GLsizeiptr size = region_size * StreamBuffer::Regions;
+    wglGenBuffers(1, &stream.buffer);
+    RenderState.BindBuffer(target, stream.buffer);
+    if(wglBufferStorage && HasOpenGLVersion(4, 4)) {
+        constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        wglBufferStorage(target, size, nullptr, flags);
+        stream.mapped = static_cast<unsigned char*>(wglMapBufferRange(target, 0, size, flags));
+    } else {
+        wglBufferData(target, size, nullptr, GL_DYNAMIC_DRAW);
+        stream.staging.resize(static_cast<std::size_t>(size));
+    }
+    RenderState.BindBuffer(target, 0);
+
+    return stream;
+}
+
+// Regions are used round robin, frame % Regions, so one region can be written ahead while the previous one is drawn.
+// Returns memory of the region, blocking until the GPU is done with it. The memory may be written from any thread.
+void* BeginStreamWrite(StreamBuffer& stream, int region) {
+    GLsync& fence = stream.fences[region];
+    if(fence) {
+        while(wglClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+        wglDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    return (stream.mapped ? stream.mapped : stream.staging.data()) + stream.Offset(region);
+}
+
+// Makes written bytes of the region visible to the GL, the buffer must be bound to its target
+void EndStreamWrite(StreamBuffer& stream, int region, GLsizeiptr written) {
+    if(!stream.mapped) {
+        wglBufferSubData(stream.target, stream.Offset(region), written, stream.staging.data() + stream.Offset(region));
+    }
+}
+
+// Marks the region as used by already submitted commands
+void FenceStreamRegion(StreamBuffer& stream, int region) {
+    stream.fences[region] = wglFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void DestroyStreamBuffer(StreamBuffer& stream) {
+    for(GLsync& fence : stream.fences) {
+        if(fence) {
+            wglDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+
+    if(stream.mapped) {
+        RenderState.BindBuffer(stream.target, stream.buffer);
+        wglUnmapBuffer(stream.target);
+        stream.mapped = nullptr;
+    }
+
+    RenderState.DeleteBuffer(stream.buffer);
+    stream.buffer = 0;
+}
+
+// Framebuffer taking place of the default one when rendering without a window
+struct OffscreenTarget {
+    GLuint framebuffer = 0;
+    GLuint color = 0;
+    GLuint depth_stencil = 0;
+    int width = 0;
+    int height = 0;
+};
+
+OffscreenTarget CreateOffscreenTarget(int width, int height, int samples) {
+    OffscreenTarget target;
+    target.width = width;
+    target.height = height;
+
+    wglGenRenderbuffers(1, &target.color);
+    wglBindRenderbuffer(GL_RENDERBUFFER, target.color);
+    wglRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, width, height);
+
+    wglGenRenderbuffers(1, &target.depth_stencil);
+    wglBindRenderbuffer(GL_RENDERBUFFER, target.depth_stencil);
+    wglRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH24_STENCIL8, width, height);
+    wglBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    wglGenFramebuffers(1, &target.framebuffer);
+    wglBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+    wglFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.color);
+    wglFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, target.depth_stencil);
+    if(wglCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        ReportError("Offscreen framebuffer is incomplete");
+    }
+
+    glViewport(0, 0, width, height);
+    return target;
+}
+
+// Resolves the target and writes it as a binary PPM image, leaves the target bound
+bool WriteOffscreenTarget(const OffscreenTarget& target, const std::string& path) {
+    GLuint resolved_color, resolved;
+    wglGenRenderbuffers(1, &resolved_color);
+    wglBindRenderbuffer(GL_RENDERBUFFER, resolved_color);
+    wglRenderbufferStorageMultisample(GL_RENDERBUFFER, 0, GL_RGBA8, target.width, target.height);
+    wglBindRenderbuffer(GL_RENDERBUFFER, 0);
+    wglGenFramebuffers(1, &resolved);
+    wglBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolved);
+    wglFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, resolved_color);
+
+    wglBindFramebuffer(GL_READ_FRAMEBUFFER, target.framebuffer);
+    wglBlitFramebuffer(0, 0, target.width, target.height, 0, 0, target.width, target.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    std::vector<unsigned char> pixels(static_cast<std::size_t>(target.width) * target.height * 3);
+    wglBindFramebuffer(GL_READ_FRAMEBUFFER, resolved);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, target.width, target.height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+
+    wglBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+    wglDeleteFramebuffers(1, &resolved);
+    wglDeleteRenderbuffers(1, &resolved_color);
+
+    std::ofstream file(path, std::ios::binary);
+    if(!file) {
+        return false;
+    }
+
+    // Rows are stored bottom-up by OpenGL and top-down by PPM
+    file << "P6\n" << target.width << " " << target.height << "\n255\n";
+    const std::size_t row_size = static_cast<std::size_t>(target.width) * 3;
+    for(int row = target.height - 1; row >= 0; row--) {
+        file.write(reinterpret_cast<const char*>(pixels.data() + row * row_size), row_size);
+    }
+
+    return static_cast<bool>(file);
+}
+
+void DestroyOffscreenTarget(OffscreenTarget& target) {
+    wglDeleteFramebuffers(1, &target.framebuffer);
+    wglDeleteRenderbuffers(1, &target.color);
+    wglDeleteRenderbuffers(1, &target.depth_stencil);
+    target = OffscreenTarget{};
+}
+
+// Render passes timed on the GPU, in the order they are submitted every frame
+enum class GpuPass {
+    Cull,       // Culling on the GPU, empty unless CubeWave runs with --gpu-cull
+    Clear,
+    Grid,
+    Present,    // Swap or flush, includes the multisample resolve of the window
+    Count
+};
+
+constexpr const char* GpuPassNames[] = { "cull", "clear", "grid", "present" };
+
+// Pass durations of one frame
+struct GpuFrameTimes {
+    std::size_t frame = 0;
+    std::array<double, static_cast<std::size_t>(GpuPass::Count)> pass_ms{};
+};
+
+// GL_TIMESTAMP queries written at pass boundaries into a ring of Latency frames, a frame is read back
+// when its slot comes around again and dropped if the GPU has not reached it yet, so profiling never stalls
+struct GpuProfiler {
+    static constexpr std::size_t Latency = 4;
+    static constexpr std::size_t Timestamps = static_cast<std::size_t>(GpuPass::Count) + 1;
+
+    bool enabled = false;
+    std::array<std::array<GLuint, Timestamps>, Latency> queries{};
+    std::array<bool, Latency> pending{};
+    std::size_t frame = 0;
+    std::size_t pass = 0;                   // Passes ended so far in the current frame
+    std::vector<GpuFrameTimes> results;     // In frame order, without dropped frames
+    long dropped = 0;
+};
+
+GpuProfiler CreateGpuProfiler(bool enabled) {
+    GpuProfiler profiler;
+    profiler.enabled = enabled;
+    if(enabled) {
+        for(auto& slot : profiler.queries) {
+            wglGenQueries(static_cast<GLsizei>(slot.size()), slot.data());
+        }
+    }
+
+    return profiler;
+}
+
+// Reads a slot written Latency frames ago, wait forces the read when results are not available yet
+void CollectGpuFrame(GpuProfiler& profiler, std::size_t frame, bool wait) {
+    const std::size_t slot = frame % GpuProfiler::Latency;
+    if(!profiler.pending[slot]) {
+        return;
+    }
+    profiler.pending[slot] = false;
+
+    GLint available = GL_FALSE;
+    wglGetQueryObjectiv(profiler.queries[slot].back(), GL_QUERY_RESULT_AVAILABLE, &available);
+    if(!available && !wait) {
+        profiler.dropped++;
+        return;
+    }
+
+    std::array<GLuint64, GpuProfiler::Timestamps> timestamps;
+    for(std::size_t i = 0; i < timestamps.size(); i++) {
+        wglGetQueryObjectui64v(profiler.queries[slot][i], GL_QUERY_RESULT, &timestamps[i]);
+    }
+
+    GpuFrameTimes times;
+    times.frame = frame;
+    for(std::size_t i = 0; i < times.pass_ms.size(); i++) {
+        times.pass_ms[i] = (timestamps[i + 1] - timestamps[i]) / 1.0e6;
+    }
+    profiler.results.push_back(times);
+}
+
+void BeginGpuFrame(GpuProfiler& profiler) {
+    if(!profiler.enabled) {
+        return;
+    }
+
+    if(profiler.frame >= GpuProfiler::Latency) {
+        CollectGpuFrame(profiler, profiler.frame - GpuProfiler::Latency, false);
+    }
+
+    profiler.pass = 0;
+    wglQueryCounter(profiler.queries[profiler.frame % GpuProfiler::Latency][0], GL_TIMESTAMP);
+}
+
+// Passes have to be ended in GpuPass order, each one starts where the previous ended
+void EndGpuPass(GpuProfiler& profiler, GpuPass pass) {
+    if(!profiler.enabled || static_cast<std::size_t>(pass) != profiler.pass) {
+        return;
+    }
+
+    profiler.pass++;
+    wglQueryCounter(profiler.queries[profiler.frame % GpuProfiler::Latency][profiler.pass], GL_TIMESTAMP);
+}
+
+void EndGpuFrame(GpuProfiler& profiler) {
+    if(!profiler.enabled) {
+        return;
+    }
+
+    // Frames missing a pass are never read back
+    profiler.pending[profiler.frame % GpuProfiler::Latency] = profiler.pass + 1 == GpuProfiler::Timestamps;
+    profiler.frame++;
+}
+
+// Reads the frames still in flight, waiting for the GPU to finish them
+void FlushGpuProfiler(GpuProfiler& profiler) {
+    const std::size_t first = profiler.frame > GpuProfiler::Latency ? profiler.frame - GpuProfiler::Latency : 0;
+    for(std::size_t frame = first; frame < profiler.frame; frame++) {
+        CollectGpuFrame(profiler, frame, true);
+    }
+}
+
+void DestroyGpuProfiler(GpuProfiler& profiler) {
+    if(profiler.enabled) {
+        for(auto& slot : profiler.queries) {
+            wglDeleteQueries(static_cast<GLsizei>(slot.size()), slot.data());
+        }
+    }
+    profiler = GpuProfiler{};
+}
+
+float GetTime() {
+    return static_cast<float>(GetTimeNs() / 1.0e9);
+}
+
+// Holds frames to a target rate, sleeping for most of the wait and spinning the last SpinNs for precision
+struct FramePacer {
+    static constexpr std::int64_t SpinNs = 2000000;
+
+    std::int64_t period_ns = 0;     // 0 leaves frames unpaced
+    std::int64_t deadline_ns = 0;   // When the next frame may start
+};
+
+FramePacer CreateFramePacer(double fps) {
+    FramePacer pacer;
+    if(fps > 0.0) {
+        pacer.period_ns = static_cast<std::int64_t>(1.0e9 / fps);
+        SetPlatformTimerResolution(true);
+    }
+
+    return pacer;
+}
+
+void PaceFrame(FramePacer& pacer) {
+    if(pacer.period_ns == 0) {
+        return;
+    }
+
+    PROFILE_ZONE("PaceFrame");
+
+    // A frame late by a whole period restarts the schedule instead of rushing to catch up
+    std::int64_t now = GetTimeNs();
+    if(pacer.deadline_ns == 0 || now - pacer.deadline_ns > pacer.period_ns) {
+        pacer.deadline_ns = now;
+    }
+
+    for(std::int64_t remaining = pacer.deadline_ns - now; remaining > 0; remaining = pacer.deadline_ns - GetTimeNs()) {
+        if(remaining > FramePacer::SpinNs) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(remaining - FramePacer::SpinNs));
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    pacer.deadline_ns += pacer.period_ns;
+}
+
+void DestroyFramePacer(FramePacer& pacer) {
+    if(pacer.period_ns != 0) {
+        SetPlatformTimerResolution(false);
+    }
+    pacer = FramePacer{};
+}
+
+// Simulation advances in fixed steps independent of the render rate, frames are rendered by
+// interpolating the two latest steps so the simulated step at time straddles the render time
+struct FixedTimestep {
+    static constexpr int MaxSteps = 8;  // Per frame, a longer hitch drops time instead of snowballing
+
+    double step = 0.0;      // 0 simulates once per frame at the render time
+    double time = 0.0;      // Of the latest step
+    double alpha = 1.0;     // Render time between time - step and time
+};
+
+FixedTimestep CreateFixedTimestep(double rate) {
+    FixedTimestep timestep;
+    if(rate > 0.0) {
+        timestep.step = 1.0 / rate;
+    }
+
+    return timestep;
+}
+
+// Returns number of steps to simulate before rendering at render_time
+int AdvanceFixedTimestep(FixedTimestep& timestep, double render_time) {
+    if(timestep.step == 0.0) {
+        timestep.time = render_time;
+        return 1;
+    }
+
+    if(render_time - timestep.time >= FixedTimestep::MaxSteps * timestep.step) {
+        timestep.time = render_time - (FixedTimestep::MaxSteps - 1) * timestep.step;
+    }
+
+    int steps = 0;
+    while(timestep.time <= render_time) {
+        timestep.time += timestep.step;
+        steps++;
+    }
+    timestep.alpha = (render_time - (timestep.time - timestep.step)) / timestep.step;
+
+    return steps;
+}
+
+
+/******************
+ * Frame pipeline *
+ ******************/
+// Task graph of a frame. A stage with lead runs that many frames ahead of the rest and job stages run on the
+// job system without blocking the render thread. Stages ahead are started before the stages of the current frame
+// and only waited for after them, so the CPU work of frame N + 1 overlaps submission of frame N.
+// Everything a stage touches for a frame ahead has to be buffered per frame by the scene.
+class FramePipeline {
+public:
+    using StageBody = std::function<void(long)>;
+    using RangeBody = std::function<void(long, std::size_t, std::size_t)>;
+
+    explicit FramePipeline(JobSystem& jobs)
+        : jobs(jobs) {
+    }
+
+    FramePipeline(const FramePipeline&) = delete;
+    FramePipeline& operator=(const FramePipeline&) = delete;
+
+    ~FramePipeline() {
+        Drain();
+    }
+
+    // Stage run on the render thread, dependencies are earlier stages which have to finish the same frame first
+    std::size_t AddStage(const char* name, int lead, std::initializer_list<std::size_t> dependencies, StageBody body) {
+        stages.push_back(std::make_unique<Stage>());
+        Stage& stage = *stages.back();
+        stage.name = name;
+        stage.lead = lead;
+        stage.dependencies = dependencies;
+        stage.body = std::move(body);
+        return stages.size() - 1;
+    }
+
+    // Stage split into jobs over [0, count), consecutive frames of one job stage never overlap
+    std::size_t AddJobStage(const char* name, int lead, std::initializer_list<std::size_t> dependencies,
+                            std::size_t count, std::size_t grain, RangeBody body) {
+        const std::size_t index = AddStage(name, lead, dependencies, nullptr);
+        Stage& stage = *stages[index];
+        stage.count = count;
+        stage.grain = grain;
+        stage.range_body = std::move(body);
+        return index;
+    }
+
+    // Runs every stage up to frame plus its lead. Stages ahead first go as far as they can without waiting, then
+    // all stages run in the order they were added, those of smaller lead first.
+    void RunFrame(long frame) {
+        int max_lead = 0;
+        for(std::size_t index = 0; index < stages.size(); index++) {
+            max_lead = std::max(max_lead, stages[index]->lead);
+            if(stages[index]->lead > 0) {
+                Run(index, frame + stages[index]->lead, false);
+            }
+        }
+
+        for(int lead = 0; lead <= max_lead; lead++) {
+            for(std::size_t index = 0; index < stages.size(); index++) {
+                if(stages[index]->lead == lead) {
+                    Run(index, frame + lead, true);
+                }
+            }
+        }
+    }
+
+    // Waits for job stages still in flight
+    void Drain() {
+        for(std::size_t index = 0; index < stages.size(); index++) {
+            Finish(index, std::numeric_limits<long>::max());
+        }
+    }
+
+private:
+    struct Stage {
+        const char* name = nullptr;
+        int lead = 0;
+        std::vector<std::size_t> dependencies;
+        StageBody body;
+        RangeBody range_body;
+        std::size_t count = 0;
+        std::size_t grain = 1;
+        JobSystem::RangeBody job;               // range_body bound to the frame in flight
+        std::atomic<std::size_t> remaining{ 0 };
+        long next_frame = 0;                    // First frame not started yet
+        long in_flight_frame = 0;
+        bool in_flight = false;
+    };
+
+    // Starts every frame of the stage up to frame, finishing dependencies of each of them first. Without wait
+    // it stops at the first frame whose dependencies are not done yet and returns false.
+    bool Run(std::size_t index, long frame, bool wait) {
+        Stage& stage = *stages[index];
+        while(stage.next_frame <= frame) {
+            const long target = stage.next_frame;
+            for(std::size_t dependency : stage.dependencies) {
+                if(!Run(dependency, target, wait) || !Finish(dependency, target, wait)) {
+                    return false;
+                }
+            }
+
+            // Consecutive frames of a job stage share the job
+            if(stage.range_body && !Finish(index, target - 1, wait)) {
+                return false;
+            }
+
+            stage.next_frame++;
+            if(!stage.range_body) {
+                ProfileZone zone(stage.name);
+                stage.body(target);
+                continue;
+            }
+
+            stage.job = [&stage, target](std::size_t begin, std::size_t end) {
+                stage.range_body(target, begin, end);
+            };
+            stage.in_flight = true;
+            stage.in_flight_frame = target;
+            jobs.Dispatch(0, stage.count, stage.grain, stage.job, stage.remaining);
+        }
+        return true;
+    }
+
+    // Makes sure frame of a started stage is done, returns false when it is still running and wait is not set
+    bool Finish(std::size_t index, long frame, bool wait = true) {
+        Stage& stage = *stages[index];
+        if(!stage.in_flight || stage.in_flight_frame > frame) {
+            return true;
+        }
+        if(stage.remaining.load(std::memory_order_acquire) > 0) {
+            if(!wait) {
+                return false;
+            }
+            ProfileZone zone(stage.name);
+            jobs.Wait(stage.remaining);
+        }
+        stage.in_flight = false;
+        return true;
+    }
+
+    JobSystem& jobs;
+    std::vector<std::unique_ptr<Stage>> stages;
+};
+
+
+/******************************************
+ * Sources of shaders used in the program *
+ ******************************************/
+const char* VertexShaderSource =
+"#version 330 core\n"
+"layout(location = 0) in vec3 aPos;\n"
+"layout(location = 1) in float aFace;\n"
+"layout(location = 2) in vec2 aOffset;\n"
+"layout(location = 3) in float aHeight;\n"
+"layout(std140) uniform Frame {\n"
+"    mat4 pv;\n"
+"    float time;\n"
+"    float previousTime;\n"
+"    float alpha;\n"
+"};\n"
+"layout(std140) uniform Palette {\n"
+"    vec4 faceColors[6];\n"
+"};\n"
+"uniform bool procedural;\n"
+"uniform ivec2 gridSize;\n"
+"uniform ivec2 reverseCells;\n"
+"uniform float SIN_MULTIPLIER;\n"
+"uniform float CUBE_HEIGHT_MULTIPLIER;\n"
+"uniform float MIN_CUBE_HEIGHT;\n"
+"out vec4 VertexColor;\n"
+"float Wave(float t, float distance_factor) {\n"
+"    return CUBE_HEIGHT_MULTIPLIER * sin(SIN_MULTIPLIER * t + distance_factor) + MIN_CUBE_HEIGHT;\n"
+"}\n"
+"void main() {\n"
+"    vec2 offset = aOffset;\n"
+"    float height = aHeight;\n"
+"    if(procedural) {\n"
+"        ivec2 cell = ivec2(gl_InstanceID / gridSize.y, gl_InstanceID % gridSize.y);\n"
+"        cell += reverseCells * (gridSize - 1 - 2 * cell);\n"
+"        offset = vec2(cell - gridSize / 2);\n"
+"        float distance_factor = length(offset) * 0.9;\n"
+"        height = mix(Wave(previousTime, distance_factor), Wave(time, distance_factor), alpha);\n"
+"    }\n"
+"    vec3 position = 0.5 * aPos;\n"
+"    VertexColor = faceColors[int(aFace)];\n"
+"    gl_Position = pv * vec4(position.x + offset.x, position.y * height, position.z + offset.y, 1.0);\n"
+"}\n\0";
+
+const char* FragmentShaderSource =
+"#version 330 core\n"
+"in vec4 VertexColor;\n"
+"out vec4 FragColor;\n"
+"void main() {\n"
+"    FragColor = VertexColor;\n"
+"}\n\0";
+
+// Shaders below are assembled from several sources, the #version line is passed first
+const char* FrameBlockShaderSource =
+"layout(std140) uniform Frame {\n"
+"    mat4 pv;\n"
+"    float time;\n"
+"    float previousTime;\n"
+"    float alpha;\n"
+"};\n\0";
+
+// Cell id of the CubeWave grid evaluated the same way as by the procedural vertex shader, returned as (x, z, height),
+// and the frustum test of CullCubeInstances
+const char* CubeCullShaderSource =
+"uniform ivec2 gridSize;\n"
+"uniform ivec2 reverseCells;\n"
+"uniform float SIN_MULTIPLIER;\n"
+"uniform float CUBE_HEIGHT_MULTIPLIER;\n"
+"uniform float MIN_CUBE_HEIGHT;\n"
+"uniform vec4 frustum[6];\n"
+"float Wave(float t, float distance_factor) {\n"
+"    return CUBE_HEIGHT_MULTIPLIER * sin(SIN_MULTIPLIER * t + distance_factor) + MIN_CUBE_HEIGHT;\n"
+"}\n"
+"vec3 Cell(int id) {\n"
+"    ivec2 cell = ivec2(id / gridSize.y, id % gridSize.y);\n"
+"    cell += reverseCells * (gridSize - 1 - 2 * cell);\n"
+"    vec2 offset = vec2(cell - gridSize / 2);\n"
+"    float distance_factor = length(offset) * 0.9;\n"
+"    return vec3(offset, mix(Wave(previousTime, distance_factor), Wave(time, distance_factor), alpha));\n"
+"}\n"
+"bool CubeVisible(vec3 cell) {\n"
+"    float height = abs(cell.z);\n"
+"    for(int i = 0; i < 6; i++) {\n"
+"        vec4 p = frustum[i];\n"
+"        if(p.x * cell.x + p.z * cell.y + p.w + (0.5 * (abs(p.x) + abs(p.z)) + 0.5 * abs(p.y) * height) < 0.0) {\n"
+"            return false;\n"
+"        }\n"
+"    }\n"
+"    return true;\n"
+"}\n\0";
+
+// One invocation per cell, dispatched twice. The first pass counts the survivors of every workgroup, the second
+// writes them after those of all earlier workgroups so they keep the order of the cells, and counts them in the
+// indirect draw command.
+const char* CullComputeShaderSource =
+"layout(local_size_x = 256) in;\n"
+"layout(std430, binding = 0) writeonly buffer Instances {\n"
+"    float instances[];\n"
+"};\n"
+"layout(std430, binding = 1) buffer Command {\n"
+"    uint count;\n"
+"    uint instanceCount;\n"
+"    uint firstIndex;\n"
+"    int baseVertex;\n"
+"    uint baseInstance;\n"
+"};\n"
+"layout(std430, binding = 2) buffer GroupCounts {\n"
+"    uint groupCounts[];\n"
+"};\n"
+"uniform bool compact;\n"
+"shared uint offsets[256];\n"
+"shared uint partial[256];\n"
+"void main() {\n"
+"    int id = int(gl_GlobalInvocationID.x);\n"
+"    uint local = gl_LocalInvocationIndex;\n"
+"    vec3 cell = vec3(0.0);\n"
+"    bool visible = false;\n"
+"    if(id < gridSize.x * gridSize.y) {\n"
+"        cell = Cell(id);\n"
+"        visible = CubeVisible(cell);\n"
+"    }\n"
+"    offsets[local] = visible ? 1u : 0u;\n"
+"    barrier();\n"
+"    for(uint stride = 1u; stride < 256u; stride *= 2u) {\n"
+"        uint value = local >= stride ? offsets[local - stride] : 0u;\n"
+"        barrier();\n"
+"        offsets[local] += value;\n"
+"        barrier();\n"
+"    }\n"
+"    if(!compact) {\n"
+"        if(local == 255u) {\n"
+"            groupCounts[gl_WorkGroupID.x] = offsets[255];\n"
+"        }\n"
+"        return;\n"
+"    }\n"
+"    uint sum = 0u;\n"
+"    for(uint group = local; group < gl_WorkGroupID.x; group += 256u) {\n"
+"        sum += groupCounts[group];\n"
+"    }\n"
+"    partial[local] = sum;\n"
+"    barrier();\n"
+"    for(uint stride = 128u; stride > 0u; stride /= 2u) {\n"
+"        if(local < stride) {\n"
+"            partial[local] += partial[local + stride];\n"
+"        }\n"
+"        barrier();\n"
+"    }\n"
+"    if(local == 255u && gl_WorkGroupID.x == gl_NumWorkGroups.x - 1u) {\n"
+"        instanceCount = partial[0] + offsets[255];\n"
+"    }\n"
+"    if(visible) {\n"
+"        uint slot = 3u * (partial[0] + offsets[local] - 1u);\n"
+"        instances[slot] = cell.x;\n"
+"        instances[slot + 1u] = cell.y;\n"
+"        instances[slot + 2u] = cell.z;\n"
+"    }\n"
+"}\n\0";
+
+// Merged meshes are built in world space
+const char* MeshVertexShaderSource =
+"layout(location = 0) in vec3 aPos;\n"
+"layout(location = 1) in float aFace;\n"
+"layout(std140) uniform Palette {\n"
+"    vec4 faceColors[6];\n"
+"};\n"
+"out vec4 VertexColor;\n"
+"void main() {\n"
+"    VertexColor = faceColors[int(aFace)];\n"
+"    gl_Position = pv * vec4(aPos, 1.0);\n"
+"}\n\0";
+
+// Transform feedback fallback, one point per cell and the geometry shader passes on survivors only
+const char* CullVertexShaderSource =
+"out vec3 vCell;\n"
+"flat out int vVisible;\n"
+"void main() {\n"
+"    vCell = Cell(gl_VertexID);\n"
+"    vVisible = CubeVisible(vCell) ? 1 : 0;\n"
+"}\n\0";
+
+const char* CullGeometryShaderSource =
+"#version 400 core\n"
+"layout(points) in;\n"
+"layout(points, max_vertices = 1) out;\n"
+"in vec3 vCell[];\n"
+"flat in int vVisible[];\n"
+"out vec3 instance;\n"
+"void main() {\n"
+"    if(vVisible[0] != 0) {\n"
+"        instance = vCell[0];\n"
+"        EmitVertex();\n"
+"        EndPrimitive();\n"
+"    }\n"
+"}\n\0";
+
+// Captured survivors are drawn as points and expanded into cubes, every face of cubeCorners is emitted as a strip
+// split along the same diagonal as in CubeIndices
+const char* ExpandVertexShaderSource =
+"#version 400 core\n"
+"layout(location = 2) in vec2 aOffset;\n"
+"layout(location = 3) in float aHeight;\n"
+"out vec3 vCell;\n"
+"void main() {\n"
+"    vCell = vec3(aOffset, aHeight);\n"
+"}\n\0";
+
+const char* ExpandGeometryShaderSource =
+"layout(points) in;\n"
+"layout(triangle_strip, max_vertices = 24) out;\n"
+"layout(std140) uniform Palette {\n"
+"    vec4 faceColors[6];\n"
+"};\n"
+"uniform vec3 cubeCorners[24];\n"
+"uniform int faceMask;\n"
+"in vec3 vCell[];\n"
+"out vec4 VertexColor;\n"
+"void main() {\n"
+"    const int strip[4] = int[](1, 2, 0, 3);\n"
+"    for(int face = 0; face < 6; face++) {\n"
+"        if((faceMask & (1 << face)) == 0) {\n"
+"            continue;\n"
+"        }\n"
+"        for(int i = 0; i < 4; i++) {\n"
+"            vec3 position = 0.5 * cubeCorners[4 * face + strip[i]];\n"
+"            VertexColor = faceColors[face];\n"
+"            gl_Position = pv * vec4(position.x + vCell[0].x, position.y * vCell[0].z, position.z + vCell[0].y, 1.0);\n"
+"            EmitVertex();\n"
+"        }\n"
+"        EndPrimitive();\n"
+"    }\n"
+"}\n\0";
+
+
+/*************************
+ * Constants and globals *
+ *************************/
+constexpr int WindowWidth = 800;
+constexpr int WindowHeight = 600;
+
+// Per-frame data shared by all programs through the "Frame" uniform block (std140 layout)
+struct FrameUniforms {
+    mat4 pv;
+    GLfloat time;           // Latest simulation step
+    GLfloat previous_time;  // Step before it
+    GLfloat alpha;          // Where the rendered frame falls between the two steps
+    GLfloat padding;
+};
+constexpr GLuint FrameUniformsBinding = 0;
+
+// Colors of the cube faces indexed by the face id of a vertex, set by every scene in the "Palette" uniform block (std140 layout)
+constexpr std::size_t PaletteSize = 6;
+using Palette = std::array<std::array<GLfloat, 4>, PaletteSize>;
+constexpr GLuint PaletteBinding = 1;
+
+constexpr GLsizei CubeIndicesCount = sizeof(CubeIndices) / sizeof(CubeIndices[0]);
+
+// CubeIndices reduced to the faces in the mask
+std::vector<GLushort> CubeFaceIndices(GLubyte faces) {
+    std::vector<GLushort> indices;
+    for(std::size_t face = 0; face < PaletteSize; face++) {
+        if(faces & CubeFaceBit(static_cast<CubeFace>(face))) {
+            indices.insert(indices.end(), CubeIndices + 6 * face, CubeIndices + 6 * face + 6);
+        }
+    }
+    return indices;
+}
+
+// Interleaved cube vertex, 4 bytes with the color looked up in the palette
+struct CubeVertex {
+    GLbyte position[3];     // Corner from CubeVertices
+    GLubyte face;           // Index into the palette
+};
+
+const VertexLayout CubeVertexLayout{ sizeof(CubeVertex), 0, {
+    { 0, 3, GL_BYTE, GL_FALSE, offsetof(CubeVertex, position) },
+    { 1, 1, GL_UNSIGNED_BYTE, GL_FALSE, offsetof(CubeVertex, face) }
+}};
+
+const VertexLayout CubeInstanceLayout{ sizeof(CubeInstance), 1, {
+    { 2, 2, GL_FLOAT, GL_FALSE, offsetof(CubeInstance, x) },
+    { 3, 1, GL_FLOAT, GL_FALSE, offsetof(CubeInstance, height) }
+}};
+
+// Where CubeWave evaluates heights of the cubes
+enum class CubeWaveMode {
+    CpuInstanced,   // Heights computed on the CPU and streamed as instance attributes
+    GpuProcedural,  // Heights computed in the vertex shader from gl_InstanceID and time
+    GpuCulled,      // Heights and visibility computed on the GPU, survivors drawn without the CPU knowing their count
+    CpuMeshed       // Heights computed on the CPU and merged into one mesh, rebuilt only where heights changed
+};
+
+constexpr const char* CubeWaveModeNames[] = { "cpu", "gpu", "gpu-cull", "cpu-mesh" };
+
+// Visualizations selectable with --scene
+enum class Scene {
+    CubeWave
+    // PenroseStairs
+};
+
+
+/***************
+ * GPU culling *
+ ***************/
+// Layout of a glDrawElementsIndirect command
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instance_count;
+    GLuint first_index;
+    GLint base_vertex;
+    GLuint base_instance;
+};
+
+// Culls the CubeWave grid on the GPU and keeps the survivors there, in the order of the cells. With compute shaders
+// (OpenGL 4.3) survivors are compacted as CubeInstances and counted in an indirect draw command of the indexed cube.
+// Older contexts capture survivors with transform feedback and draw them as points expanded into cubes by a
+// geometry shader.
+struct GpuCuller {
+    bool compute = false;
+    GLsizei cells = 0;
+    ProgramReflection cull_program;     // Evaluates and tests the cells, uniforms of CubeCullShaderSource are set by the scene
+    ProgramReflection draw_program;     // Transform feedback only, expands survivors into cubes
+    GLint compact_location = -1;        // Selects the pass of the cull program, compute only
+    GLuint instances = 0;               // Survivors as CubeInstances
+    GLuint command = 0;                 // DrawElementsIndirectCommand, compute only
+    GLuint group_counts = 0;            // Survivors of every workgroup, compute only
+    GLuint feedback = 0;                // Transform feedback object, transform feedback only
+    GLuint cull_vao = 0;                // Without attributes, transform feedback only
+    GLuint draw_vao = 0;                // Survivors as points, transform feedback only
+};
+
+GpuCuller CreateGpuCuller(GLsizei cells) {
+    GpuCuller culler;
+    culler.compute = wglDispatchCompute && wglMemoryBarrier && HasOpenGLVersion(4, 3);
+    culler.cells = cells;
+
+    wglGenBuffers(1, &culler.instances);
+    RenderState.BindBuffer(GL_ARRAY_BUFFER, culler.instances);
+    wglBufferData(GL_ARRAY_BUFFER, sizeof(CubeInstance) * cells, nullptr, GL_DYNAMIC_COPY);
+
+    if(culler.compute) {
+        const GLuint compute_shader = CreateShader({ "#version 430 core\n", FrameBlockShaderSource, CubeCullShaderSource, CullComputeShaderSource }, GL_COMPUTE_SHADER);
+        culler.cull_program = ReflectProgram(CreateProgram({ compute_shader }));
+        culler.compact_location = culler.cull_program.Uniform("compact");
+        wglDeleteShader(compute_shader);
+
+        // Shader only writes the instance count
+        const DrawElementsIndirectCommand command{ static_cast<GLuint>(CubeIndicesCount), 0, 0, 0, 0 };
+        wglGenBuffers(1, &culler.command);
+        RenderState.BindBuffer(GL_DRAW_INDIRECT_BUFFER, culler.command);
+        wglBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(command), &command, GL_DYNAMIC_DRAW);
+
+        RenderState.BindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, culler.instances);
+        RenderState.BindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, culler.command);
+
+        wglGenBuffers(1, &culler.group_counts);
+        RenderState.BindBuffer(GL_SHADER_STORAGE_BUFFER, culler.group_counts);
+        wglBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * ((cells + 255) / 256), nullptr, GL_DYNAMIC_COPY);
+        RenderState.BindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, culler.group_counts);
+    } else {
+        const GLuint cull_vertex_shader = CreateShader({ "#version 400 core\n", FrameBlockShaderSource, CubeCullShaderSource, CullVertexShaderSource }, GL_VERTEX_SHADER);
+        const GLuint cull_geometry_shader = CreateShader(CullGeometryShaderSource, GL_GEOMETRY_SHADER);
+        culler.cull_program = ReflectProgram(CreateProgram({ cull_vertex_shader, cull_geometry_shader }, { "instance" }));
+        wglDeleteShader(cull_vertex_shader);
+        wglDeleteShader(cull_geometry_shader);
+
+        const GLuint draw_vertex_shader = CreateShader(ExpandVertexShaderSource, GL_VERTEX_SHADER);
+        const GLuint draw_geometry_shader = CreateShader({ "#version 400 core\n", FrameBlockShaderSource, ExpandGeometryShaderSource }, GL_GEOMETRY_SHADER);
+        const GLuint draw_fragment_shader = CreateShader(FragmentShaderSource, GL_FRAGMENT_SHADER);
+        culler.draw_program = ReflectProgram(CreateProgram({ draw_vertex_shader, draw_geometry_shader, draw_fragment_shader }));
+        wglDeleteShader(draw_vertex_shader);
+        wglDeleteShader(draw_geometry_shader);
+        wglDeleteShader(draw_fragment_shader);
+        culler.draw_program.BindUniformBlock("Frame", FrameUniformsBinding);
+        culler.draw_program.BindUniformBlock("Palette", PaletteBinding);
+
+        std::array<GLfloat, sizeof(CubeVertices)> corners;
+        for(std::size_t i = 0; i < corners.size(); i++) {
+            corners[i] = CubeVertices[i];
+        }
+        RenderState.UseProgram(culler.draw_program.program);
+        wglUniform3fv(culler.draw_program.Uniform("cubeCorners"), static_cast<GLsizei>(corners.size() / 3), corners.data());
+        wglUniform1i(culler.draw_program.Uniform("faceMask"), AllCubeFaces);
+
+        wglGenTransformFeedbacks(1, &culler.feedback);
+        wglBindTransformFeedback(GL_TRANSFORM_FEEDBACK, culler.feedback);
+        RenderState.BindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, culler.instances);
+        wglBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+
+        // Same attributes as the instanced draw, advanced per point
+        VertexLayout points = CubeInstanceLayout;
+        points.divisor = 0;
+        wglGenVertexArrays(1, &culler.cull_vao);
+        wglGenVertexArrays(1, &culler.draw_vao);
+        RenderState.BindVertexArray(culler.draw_vao);
+        RenderState.BindBuffer(GL_ARRAY_BUFFER, culler.instances);
+        ApplyVertexLayout(points);
+    }
+    culler.cull_program.BindUniformBlock("Frame", FrameUniformsBinding);
+
+    return culler;
+}
+
+// Limits drawn cubes to the faces in the mask, the compute path expects the index buffer of its vao to hold
+// CubeFaceIndices of the same mask
+void SetGpuCullerFaces(GpuCuller& culler, GLubyte faces) {
+    if(culler.compute) {
+        const GLuint count = static_cast<GLuint>(CubeFaceIndices(faces).size());
+        RenderState.BindBuffer(GL_DRAW_INDIRECT_BUFFER, culler.command);
+        wglBufferSubData(GL_DRAW_INDIRECT_BUFFER, offsetof(DrawElementsIndirectCommand, count), sizeof(count), &count);
+    } else {
+        RenderState.UseProgram(culler.draw_program.program);
+        wglUniform1i(culler.draw_program.Uniform("faceMask"), faces);
+    }
+}
+
+// Replaces the survivors with the cells that pass the frustum test at the current Frame uniforms
+void CullOnGpu(GpuCuller& culler) {
+    RenderState.UseProgram(culler.cull_program.program);
+    if(culler.compute) {
+        const GLuint groups = (culler.cells + 255) / 256;
+        wglUniform1i(culler.compact_location, GL_FALSE);
+        wglDispatchCompute(groups, 1, 1);
+        wglMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        wglUniform1i(culler.compact_location, GL_TRUE);
+        wglDispatchCompute(groups, 1, 1);
+        wglMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    } else {
+        RenderState.BindVertexArray(culler.cull_vao);
+        RenderState.Enable(GL_RASTERIZER_DISCARD);
+        wglBindTransformFeedback(GL_TRANSFORM_FEEDBACK, culler.feedback);
+        wglBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, culler.cells);
+        wglEndTransformFeedback();
+        wglBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+        RenderState.Disable(GL_RASTERIZER_DISCARD);
+    }
+}
+
+// Compute path draws the indexed cube with program and vao, whose instance attributes have to source culler.instances
+void DrawGpuCulled(const GpuCuller& culler, const ProgramReflection& program, GLuint vao) {
+    if(culler.compute) {
+        RenderState.UseProgram(program.program);
+        RenderState.BindVertexArray(vao);
+        RenderState.BindBuffer(GL_DRAW_INDIRECT_BUFFER, culler.command);
+        wglDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, nullptr);
+    } else {
+        RenderState.UseProgram(culler.draw_program.program);
+        RenderState.BindVertexArray(culler.draw_vao);
+        wglDrawTransformFeedback(GL_POINTS, culler.feedback);
+    }
+}
+
+void DestroyGpuCuller(GpuCuller& culler) {
+    wglDeleteProgram(culler.cull_program.program);
+    wglDeleteProgram(culler.draw_program.program);
+    wglDeleteTransformFeedbacks(1, &culler.feedback);
+    RenderState.DeleteVertexArray(culler.cull_vao);
+    RenderState.DeleteVertexArray(culler.draw_vao);
+    RenderState.DeleteBuffer(culler.instances);
+    RenderState.DeleteBuffer(culler.command);
+    RenderState.DeleteBuffer(culler.group_counts);
+    culler = GpuCuller{};
+}
+
+
+/****************************
+ * Heightfield mesh buffers *
+ ****************************/
+const VertexLayout MeshVertexLayout{ sizeof(MeshVertex), 0, {
+    { 0, 3, GL_FLOAT, GL_FALSE, offsetof(MeshVertex, position) },
+    { 1, 1, GL_UNSIGNED_BYTE, GL_FALSE, offsetof(MeshVertex, face) }
+}};
+
+// Band meshes on the GPU, drawn with a single call. Every band owns a range of the vertex buffer and of the index
+// buffer with some slack, a rebuilt band is written over its own range and the buffers are only laid out again once
+// a band outgrows it. Indices stay relative to their band.
+struct HeightfieldMeshBuffers {
+    GLuint vertex_buffer = 0;
+    GLuint index_buffer = 0;
+    GLuint vao = 0;
+    bool reverse_bands = false;                 // Draws the last band first
+    std::vector<Mesh> bands;                    // Meshes held by the ranges
+    std::vector<std::size_t> vertex_capacity;   // Size of the range of every band
+    std::vector<std::size_t> index_capacity;
+    std::vector<GLsizei> counts;                // Arguments of the draw, in draw order
+    std::vector<const void*> first_indices;
+    std::vector<GLint> base_vertices;
+};
+
+HeightfieldMeshBuffers CreateHeightfieldMeshBuffers(bool reverse_bands) {
+    HeightfieldMeshBuffers buffers;
+    buffers.reverse_bands = reverse_bands;
+    wglGenBuffers(1, &buffers.vertex_buffer);
+    wglGenBuffers(1, &buffers.index_buffer);
+    wglGenVertexArrays(1, &buffers.vao);
+    RenderState.BindVertexArray(buffers.vao);
+    RenderState.BindBuffer(GL_ARRAY_BUFFER, buffers.vertex_buffer);
+    ApplyVertexLayout(MeshVertexLayout);
+    RenderState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.index_buffer);
+    return buffers;
+}
+
+// Gives every band a range half again its size and uploads all of them
+void LayoutHeightfieldMeshBuffers(HeightfieldMeshBuffers& buffers) {
+    const std::size_t bands = buffers.bands.size();
+    buffers.vertex_capacity.resize(bands);
+    buffers.index_capacity.resize(bands);
+    buffers.counts.resize(bands);
+    buffers.first_indices.resize(bands);
+    buffers.base_vertices.resize(bands);
+
+    std::vector<MeshVertex> vertices;
+    std::vector<GLuint> indices;
+    for(std::size_t band = 0; band < bands; band++) {
+        const Mesh& mesh = buffers.bands[band];
+        const std::size_t slot = buffers.reverse_bands ? bands - 1 - band : band;
+        buffers.counts[slot] = static_cast<GLsizei>(mesh.indices.size());
+        buffers.first_indices[slot] = reinterpret_cast<const void*>(indices.size() * sizeof(GLuint));
+        buffers.base_vertices[slot] = static_cast<GLint>(vertices.size());
+        buffers.vertex_capacity[band] = mesh.vertices.size() + mesh.vertices.size() / 2 + 64;
+        buffers.index_capacity[band] = mesh.indices.size() + mesh.indices.size() / 2 + 96;
+
+        vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+        vertices.resize(buffers.base_vertices[slot] + buffers.vertex_capacity[band]);
+        indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+        indices.resize(reinterpret_cast<std::uintptr_t>(buffers.first_indices[slot]) / sizeof(GLuint) + buffers.index_capacity[band]);
+    }
+
+    RenderState.BindVertexArray(buffers.vao);
+    RenderState.BindBuffer(GL_ARRAY_BUFFER, buffers.vertex_buffer);
+    wglBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(MeshVertex), vertices.data(), GL_DYNAMIC_DRAW);
+    RenderState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.index_buffer);
+    wglBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_DYNAMIC_DRAW);
+}
+
+// Replaces band rebuilt[k] with meshes[k] out of bands, only the ranges of those bands are written. The meshes are
+// swapped in, meshes[k] is left with the previous geometry of the band.
+void UpdateHeightfieldMeshBuffers(HeightfieldMeshBuffers& buffers, std::size_t bands, const std::vector<std::size_t>& rebuilt, std::vector<Mesh>& meshes) {
+    bool fits = buffers.bands.size() == bands;
+    buffers.bands.resize(bands);
+    for(std::size_t k = 0; k < rebuilt.size(); k++) {
+        const std::size_t band = rebuilt[k];
+        SwapMeshGeometry(buffers.bands[band], meshes[k]);
+        fits = fits && buffers.bands[band].vertices.size() <= buffers.vertex_capacity[band] && buffers.bands[band].indices.size() <= buffers.index_capacity[band];
+    }
+    if(!fits) {
+        LayoutHeightfieldMeshBuffers(buffers);
+        return;
+    }
+
+    RenderState.BindVertexArray(buffers.vao);
+    RenderState.BindBuffer(GL_ARRAY_BUFFER, buffers.vertex_buffer);
+    RenderState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.index_buffer);
+    for(std::size_t band : rebuilt) {
+        const Mesh& mesh = buffers.bands[band];
+        const std::size_t slot = buffers.reverse_bands ? bands - 1 - band : band;
+        wglBufferSubData(GL_ARRAY_BUFFER, buffers.base_vertices[slot] * sizeof(MeshVertex), mesh.vertices.size() * sizeof(MeshVertex), mesh.vertices.data());
+        wglBufferSubData(GL_ELEMENT_ARRAY_BUFFER, reinterpret_cast<GLintptr>(buffers.first_indices[slot]), mesh.indices.size() * sizeof(GLuint), mesh.indices.data());
+        buffers.counts[slot] = static_cast<GLsizei>(mesh.indices.size());
+    }
+}
+
+void DrawHeightfieldMeshBuffers(const HeightfieldMeshBuffers& buffers) {
+    RenderState.BindVertexArray(buffers.vao);
+    wglMultiDrawElementsBaseVertex(GL_TRIANGLES, buffers.counts.data(), GL_UNSIGNED_INT, buffers.first_indices.data(),
+                                   static_cast<GLsizei>(buffers.counts.size()), buffers.base_vertices.data());
+}
+
+void DestroyHeightfieldMeshBuffers(HeightfieldMeshBuffers& buffers) {
+    RenderState.DeleteVertexArray(buffers.vao);
+    RenderState.DeleteBuffer(buffers.vertex_buffer);
+    RenderState.DeleteBuffer(buffers.index_buffer);
+    buffers = HeightfieldMeshBuffers{};
+}
+
+
+/****************
+ * Command line *
+ ****************/
+struct Options {
+    bool headless = false;              // --headless, render into an offscreen framebuffer without a window
+    long frames = 0;                    // --frames N, number of frames to render, 0 renders until the window is closed
+    std::string output;                 // --output FILE, PPM image of the last frame rendered headless
+    CubeWaveMode cube_wave_mode = CubeWaveMode::GpuProcedural; // --cpu-heights, --gpu-cull or --mesh, how CubeWave is evaluated
+    Scene scene = Scene::CubeWave;      // --scene NAME, visualization to run
+    int grid = 14;                      // --grid N, rows and columns of CubeWave
+    double time_step = 0.0;             // --time-step SECONDS, simulated time between frames, 0 follows the clock
+    std::string benchmark;              // --benchmark FILE, timing report written as CSV for .csv files, JSON otherwise
+    long warmup = 10;                   // --warmup N, first frames of a benchmark left out of the report
+    std::string trace;                  // --trace FILE, Chrome trace_event JSON of the CPU profiler zones
+    double fps = 0.0;                   // --fps RATE, frame rate limit, 0 renders as fast as possible
+    int swap_interval = 1;              // --vsync N, vertical blanks per swap, 0 disables vsync
+    double simulation_rate = 30.0;      // --sim-rate HZ, fixed simulation steps per second, 0 steps once per frame
+    unsigned threads = 0;               // --threads N, job system threads including the render thread, 0 uses all cores
+};
+
+bool ParseOptions(int argc, char** argv, Options& options) {
+    for(int i = 1; i < argc; i++) {
+        const std::string argument = argv[i];
+        const bool has_value = i + 1 < argc;
+
+        if(argument == "--headless") {
+            options.headless = true;
+        } else if(argument == "--frames" && has_value) {
+            options.frames = std::strtol(argv[++i], nullptr, 10);
+        } else if(argument == "--output" && has_value) {
+            options.output = argv[++i];
+        } else if(argument == "--cpu-heights") {
+            options.cube_wave_mode = CubeWaveMode::CpuInstanced;
+        } else if(argument == "--gpu-cull") {
+            options.cube_wave_mode = CubeWaveMode::GpuCulled;
+        } else if(argument == "--mesh") {
+            options.cube_wave_mode = CubeWaveMode::CpuMeshed;
+        } else if(argument == "--scene" && has_value && std::string(argv[i + 1]) == "cubewave") {
+            options.scene = Scene::CubeWave;
+            i++;
+        } else if(argument == "--grid" && has_value) {
+            options.grid = std::atoi(argv[++i]);
+        } else if(argument == "--time-step" && has_value) {
+            options.time_step = std::strtod(argv[++i], nullptr);
+        } else if(argument == "--benchmark" && has_value) {
+            options.benchmark = argv[++i];
+        } else if(argument == "--warmup" && has_value) {
+            options.warmup = std::strtol(argv[++i], nullptr, 10);
+        } else if(argument == "--trace" && has_value) {
+            options.trace = argv[++i];
+        } else if(argument == "--fps" && has_value) {
+            options.fps = std::strtod(argv[++i], nullptr);
+        } else if(argument == "--vsync" && has_value) {
+            options.swap_interval = std::atoi(argv[++i]);
+        } else if(argument == "--sim-rate" && has_value) {
+            options.simulation_rate = std::strtod(argv[++i], nullptr);
+        } else if(argument == "--threads" && has_value) {
+            options.threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else {
+            ReportError(("Invalid option: " + argument).c_str());
+            return false;
+        }
+    }
+
+    if(!options.output.empty() && !options.headless) {
+        ReportError("--output requires --headless");
+        return false;
+    }
+
+    if(options.grid < 2 || options.time_step < 0.0 || options.fps < 0.0 || options.simulation_rate < 0.0) {
+        ReportError("--grid must be at least 2, --time-step, --fps and --sim-rate must not be negative");
+        return false;
+    }
+
+    // Benchmarks are reproducible only with a bounded run at fixed time steps
+    if(!options.benchmark.empty()) {
+        if(options.frames == 0) {
+            options.frames = 1000;
+        }
+        if(options.time_step == 0.0) {
+            options.time_step = 1.0 / 60.0;
+        }
+        if(options.warmup < 0 || options.warmup >= options.frames) {
+            ReportError("--warmup must be less than --frames");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*************
+ * Benchmark *
+ *************/
+// Measurements of a single frame
+struct FrameSample {
+    double cpu_ms = 0.0;        // From the start of the frame until buffers are swapped
+    double interval_ms = 0.0;   // From the start of the frame until the start of the next one, 0 for the last frame
+    double gpu_ms = 0.0;        // GL_TIME_ELAPSED of all commands issued during the frame
+    long draw_calls = 0;
+    long instances = 0;         // Cubes submitted by the draw calls
+};
+
+// Collects a FrameSample per frame when --benchmark is given, otherwise every call is a no-op
+struct Benchmark {
+    static constexpr std::size_t QueryLatency = 4;  // Frames between issuing a timer query and reading it back
+
+    bool enabled = false;
+    std::vector<FrameSample> samples;
+    std::array<GLuint, QueryLatency> queries{};
+    std::int64_t frame_start_ns = 0;
+    long draw_calls = 0;    // Draw calls issued so far in the current frame, incremented by the scenes
+    long instances = 0;     // Instances drawn so far in the current frame, incremented by the scenes
+    GpuProfiler gpu_profiler;
+};
+
+Benchmark CreateBenchmark(const Options& options) {
+    Benchmark benchmark;
+    benchmark.enabled = !options.benchmark.empty();
+    if(benchmark.enabled) {
+        benchmark.samples.reserve(options.frames);
+        wglGenQueries(static_cast<GLsizei>(benchmark.queries.size()), benchmark.queries.data());
+    }
+    benchmark.gpu_profiler = CreateGpuProfiler(benchmark.enabled);
+
+    return benchmark;
+}
+
+// Simulated time of a frame, fixed steps make every run render the same images
+float FrameTime(const Options& options, long frame) {
+    if(options.time_step > 0.0) {
+        return static_cast<float>(frame * options.time_step);
+    }
+
+    return GetTime();
+}
+
+void ReadBenchmarkQuery(Benchmark& benchmark, std::size_t frame) {
+    GLuint64 elapsed = 0;
+    wglGetQueryObjectui64v(benchmark.queries[frame % Benchmark::QueryLatency], GL_QUERY_RESULT, &elapsed);
+    benchmark.samples[frame].gpu_ms = elapsed / 1.0e6;
+}
+
+void BeginBenchmarkFrame(Benchmark& benchmark) {
+    if(!benchmark.enabled) {
+        return;
+    }
+
+    // Query being reused was issued QueryLatency frames ago so its result is normally ready
+    const std::size_t frame = benchmark.samples.size();
+    if(frame >= Benchmark::QueryLatency) {
+        ReadBenchmarkQuery(benchmark, frame - Benchmark::QueryLatency);
+    }
+
+    const std::int64_t now = GetTimeNs();
+    if(frame > 0) {
+        benchmark.samples.back().interval_ms = (now - benchmark.frame_start_ns) / 1.0e6;
+    }
+
+    benchmark.draw_calls = 0;
+    benchmark.instances = 0;
+    benchmark.frame_start_ns = now;
+    wglBeginQuery(GL_TIME_ELAPSED, benchmark.queries[frame % Benchmark::QueryLatency]);
+    BeginGpuFrame(benchmark.gpu_profiler);
+}
+
+void EndBenchmarkFrame(Benchmark& benchmark) {
+    if(!benchmark.enabled) {
+        return;
+    }
+
+    wglEndQuery(GL_TIME_ELAPSED);
+    EndGpuFrame(benchmark.gpu_profiler);
+
+    FrameSample sample;
+    sample.cpu_ms = (GetTimeNs() - benchmark.frame_start_ns) / 1.0e6;
+    sample.draw_calls = benchmark.draw_calls;
+    sample.instances = benchmark.instances;
+    benchmark.samples.push_back(sample);
+}
+
+struct SampleSummary {
+    double mean = 0.0;
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+};
+
+// Nearest-rank percentiles
+SampleSummary Summarize(std::vector<double> values) {
+    SampleSummary summary;
+    if(values.empty()) {
+        return summary;
+    }
+
+    std::sort(values.begin(), values.end());
+    const auto percentile = [&values](double p) {
+        const std::size_t rank = static_cast<std::size_t>(std::ceil(p / 100.0 * values.size()));
+        return values[std::max<std::size_t>(rank, 1) - 1];
+    };
+
+    for(double value : values) {
+        summary.mean += value;
+    }
+    summary.mean /= values.size();
+    summary.p50 = percentile(50.0);
+    summary.p95 = percentile(95.0);
+    summary.p99 = percentile(99.0);
+    summary.max = values.back();
+
+    return summary;
+}
+
+std::string EscapeJson(const char* text) {
+    std::string escaped;
+    for(; text != nullptr && *text != '\0'; text++) {
+        if(*text == '"' || *text == '\\') {
+            escaped += '\\';
+        }
+        escaped += *text;
+    }
+
+    return escaped;
+}
+
+bool WriteBenchmarkReport(Benchmark& benchmark, const Options& options, const JobSystem& jobs) {
+    if(!benchmark.enabled) {
+        return true;
+    }
+
+    // Collect queries of the last frames, waiting for the GPU to finish them
+    const std::size_t frames = benchmark.samples.size();
+    for(std::size_t frame = frames > Benchmark::QueryLatency ? frames - Benchmark::QueryLatency : 0; frame < frames; frame++) {
+        ReadBenchmarkQuery(benchmark, frame);
+    }
+    FlushGpuProfiler(benchmark.gpu_profiler);
+
+    // Warmup frames pay for shader compilation and driver caches
+    std::vector<double> cpu_ms, gpu_ms, draw_calls, instances, interval_ms;
+    for(std::size_t frame = std::min<std::size_t>(options.warmup, frames); frame < frames; frame++) {
+        const FrameSample& sample = benchmark.samples[frame];
+        cpu_ms.push_back(sample.cpu_ms);
+        gpu_ms.push_back(sample.gpu_ms);
+        draw_calls.push_back(static_cast<double>(sample.draw_calls));
+        instances.push_back(static_cast<double>(sample.instances));
+        if(sample.interval_ms > 0.0) {
+            interval_ms.push_back(sample.interval_ms);
+        }
+    }
+
+    // Jitter is the deviation of frame intervals from their mean, low when frames are paced evenly
+    const SampleSummary interval = Summarize(interval_ms);
+    std::vector<double> jitter_ms;
+    for(double value : interval_ms) {
+        jitter_ms.push_back(std::abs(value - interval.mean));
+    }
+
+    std::vector<std::pair<std::string, SampleSummary>> metrics = {
+        { "cpu_frame_ms", Summarize(cpu_ms) },
+        { "gpu_frame_ms", Summarize(gpu_ms) },
+        { "draw_calls", Summarize(draw_calls) },
+        { "instances", Summarize(instances) },
+        { "frame_interval_ms", interval },
+        { "jitter_ms", Summarize(jitter_ms) }
+    };
+
+    // Pass breakdown tells vertex bound (grid) from fill and resolve bound (present) from submission bound (cpu)
+    for(std::size_t pass = 0; pass < static_cast<std::size_t>(GpuPass::Count); pass++) {
+        std::vector<double> pass_ms;
+        for(const GpuFrameTimes& times : benchmark.gpu_profiler.results) {
+            if(times.frame >= static_cast<std::size_t>(options.warmup)) {
+                pass_ms.push_back(times.pass_ms[pass]);
+            }
+        }
+        metrics.push_back({ std::string("gpu_") + GpuPassNames[pass] + "_ms", Summarize(pass_ms) });
+    }
+    const std::size_t measured = cpu_ms.size();
+    const char* mode = CubeWaveModeNames[static_cast<std::size_t>(options.cube_wave_mode)];
+    const std::string renderer = EscapeJson(reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+    const JobCounters& counters = jobs.Counters();
+
+    std::ofstream file(options.benchmark);
+    const bool csv = options.benchmark.size() >= 4 && options.benchmark.compare(options.benchmark.size() - 4, 4, ".csv") == 0;
+    if(csv) {
+        // One row per metric, configuration repeated so reports of several runs can be concatenated
+        file << "scene,mode,grid,frames,time_step,renderer,metric,mean,p50,p95,p99,max\n";
+        for(const auto& metric : metrics) {
+            const SampleSummary& s = metric.second;
+            file << "cubewave," << mode << ',' << options.grid << ',' << measured << ',' << options.time_step << ",\"" << renderer << "\","
+                 << metric.first << ',' << s.mean << ',' << s.p50 << ',' << s.p95 << ',' << s.p99 << ',' << s.max << '\n';
+        }
+    } else {
+        file << "{\n"
+             << "    \"scene\": \"cubewave\",\n"
+             << "    \"mode\": \"" << mode << "\",\n"
+             << "    \"grid\": " << options.grid << ",\n"
+             << "    \"frames\": " << measured << ",\n"
+             << "    \"time_step\": " << options.time_step << ",\n"
+             << "    \"renderer\": \"" << renderer << "\",\n"
+             << "    \"gpu_dropped_frames\": " << benchmark.gpu_profiler.dropped << ",\n"
+             << "    \"threads\": " << jobs.ThreadCount() << ",\n"
+             << "    \"jobs\": " << counters.jobs << ",\n"
+             << "    \"job_steals\": " << counters.steals << ",\n"
+             << "    \"job_mean_us\": " << (counters.jobs > 0 ? counters.job_ns / 1.0e3 / counters.jobs : 0.0) << ",\n"
+             << "    \"job_max_us\": " << counters.max_job_ns / 1.0e3 << ",\n"
+             << "    \"job_idle_ms\": " << counters.idle_ns / 1.0e6 << ",\n"
+             << "    \"state_calls_issued\": " << RenderState.issued << ",\n"
+             << "    \"state_calls_elided\": " << RenderState.elided;
+        for(const auto& metric : metrics) {
+            const SampleSummary& s = metric.second;
+            file << ",\n    \"" << metric.first << "\": { \"mean\": " << s.mean << ", \"p50\": " << s.p50 << ", \"p95\": " << s.p95
+                 << ", \"p99\": " << s.p99 << ", \"max\": " << s.max << " }";
+        }
+        file << "\n}\n";
+    }
+
+    return static_cast<bool>(file);
+}
+
+void DestroyBenchmark(Benchmark& benchmark) {
+    if(benchmark.enabled) {
+        wglDeleteQueries(static_cast<GLsizei>(benchmark.queries.size()), benchmark.queries.data());
+    }
+    DestroyGpuProfiler(benchmark.gpu_profiler);
+}
+
+
+/***************************************
+ * Visualizations forward declarations *
+ ***************************************/
+void CubeWave(PlatformWindow& window, const ProgramReflection& shader_program, GLuint frame_buffer, GLuint palette_buffer, const Options& options, Benchmark& benchmark, JobSystem& jobs);
+// void PenroseStairs(const Window* window, GLuint shader_program);
+
+// Everything touching OpenGL, runs on the render thread for as long as it owns the context
+int RunRenderer(PlatformWindow& window, const Options& options) {
+    NameProfilerThread("Render");
+    if(!MakePlatformContextCurrent(window, true)) {
+        ReportError("Failed to make context current on the render thread");
+        return EXIT_FAILURE;
+    }
+
+    if(!SetPlatformSwapInterval(window, options.swap_interval)) {
+        ReportError("Swap interval is not supported, --vsync is ignored");
+    }
+
+    LoadOpenGLProcs();
+
+    // Headless rendering goes to a framebuffer matching the multisampled window
+    OffscreenTarget offscreen;
+    if(options.headless) {
+        offscreen = CreateOffscreenTarget(WindowWidth, WindowHeight, 4);
+    }
+
+    // Shader program
+    const GLuint vertex_shader = CreateShader(VertexShaderSource, GL_VERTEX_SHADER);
+    const GLuint fragment_shader = CreateShader(FragmentShaderSource, GL_FRAGMENT_SHADER);
+    const GLuint shader_program = CreateProgram(vertex_shader, fragment_shader);
+    const ProgramReflection shader_program_reflection = ReflectProgram(shader_program);
+    shader_program_reflection.BindUniformBlock("Frame", FrameUniformsBinding);
+    shader_program_reflection.BindUniformBlock("Palette", PaletteBinding);
+    wglDeleteShader(vertex_shader);
+    wglDeleteShader(fragment_shader);
+
+    // Uniform buffers shared by all programs, the palette is filled by the running scene
+    GLuint frame_buffer, palette_buffer;
+    wglGenBuffers(1, &frame_buffer);
+    wglGenBuffers(1, &palette_buffer);
+    RenderState.BindBufferBase(GL_UNIFORM_BUFFER, FrameUniformsBinding, frame_buffer);
+    wglBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), nullptr, GL_DYNAMIC_DRAW);
+    RenderState.BindBufferBase(GL_UNIFORM_BUFFER, PaletteBinding, palette_buffer);
+    wglBufferData(GL_UNIFORM_BUFFER, sizeof(Palette), nullptr, GL_DYNAMIC_DRAW);
+
+    Benchmark benchmark = CreateBenchmark(options);
+    JobSystem jobs(options.threads);
+
+    // Different scenes
+    switch(options.scene) {
+        case Scene::CubeWave:
+            CubeWave(window, shader_program_reflection, frame_buffer, palette_buffer, options, benchmark, jobs);
+            break;
+
+        // case Scene::PenroseStairs:
+            // PenroseStairs(&window, shader_program, palette_buffer);
+            // break;
+
+        default:
+            break;
+    }
+
+    int status = EXIT_SUCCESS;
+    if(!options.output.empty() && !WriteOffscreenTarget(offscreen, options.output)) {
+        ReportError("Failed to write output image");
+        status = EXIT_FAILURE;
+    }
+
+    if(!WriteBenchmarkReport(benchmark, options, jobs)) {
+        ReportError("Failed to write benchmark report");
+        status = EXIT_FAILURE;
+    }
+
+    // End of application
+    DestroyBenchmark(benchmark);
+    if(options.headless) {
+        DestroyOffscreenTarget(offscreen);
+    }
+    RenderState.DeleteBuffer(frame_buffer);
+    RenderState.DeleteBuffer(palette_buffer);
+    MakePlatformContextCurrent(window, false);
+
+    return status;
+}
+
+int RunCubes(int argc, char** argv) {
+    Options options;
+    if(!ParseOptions(argc, argv, options)) {
+        return EXIT_FAILURE;
+    }
+
+    ProfilerEnabled = !options.trace.empty();
+    NameProfilerThread("Main");
+
+    PlatformWindow window;
+    if(!CreatePlatformWindow(window, "Cubes!", WindowWidth, WindowHeight, options.headless)) {
+        DestroyPlatformWindow(window);
+        return EXIT_FAILURE;
+    }
+
+    // Context moves to the render thread, a blocking message loop (window drag, resize) no longer stalls frames
+    MakePlatformContextCurrent(window, false);
+
+    std::atomic<bool> rendering{ true };
+    int status = EXIT_SUCCESS;
+    std::thread render_thread([&]() {
+        status = RunRenderer(window, options);
+        rendering = false;
+    });
+
+    while(rendering) {
+        PumpPlatformEvents(window, 10);
+    }
+    render_thread.join();
+
+    if(!options.trace.empty() && !WriteProfilerTrace(options.trace)) {
+        ReportError("Failed to write profiler trace");
+        status = EXIT_FAILURE;
+    }
+
+    DestroyPlatformWindow(window);
+
+    return status;
+}
+
+#if defined(_WIN32)
+INT WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, INT nCmdShow) {
+    return RunCubes(__argc, __argv);
+}
+#else
+int main(int argc, char** argv) {
+    return RunCubes(argc, argv);
+}
+#endif
+
+void CubeWave(PlatformWindow& window, const ProgramReflection& shader_program, GLuint frame_buffer, GLuint palette_buffer, const Options& options, Benchmark& benchmark, JobSystem& jobs) {
+    const CubeWaveMode mode = options.cube_wave_mode;
+    const int ROWS = options.grid;
+    const int COLUMNS = options.grid;
+    const int FIRST_ROW = -ROWS / 2;        // Cells span [FIRST_ROW, FIRST_ROW + ROWS), odd sizes too
+    const int FIRST_COLUMN = -COLUMNS / 2;
+    constexpr float MIN_CUBE_HEIGHT = 5.0f;
+    constexpr float CUBE_HEIGHT_MULTIPLIER = 3.0f;
+    constexpr float SIN_MULTIPLIER = 2.0f;
+
+    // Verticies
+    const Palette palette{{
+        { 1.0f,  1.0f,  1.0f,  1.0f },     // back
+        { 0.0f,  0.0f,  0.18f, 1.0f },     // front
+        { 1.0f,  1.0f,  1.0f,  1.0f },     // left
+        { 0.65f, 0.8f,  0.6f,  1.0f },     // right
+        { 1.0f,  1.0f,  1.0f,  1.0f },     // down
+        { 0.4f,  0.6f,  0.65f, 1.0f }      // top
+    }};
+
+    // Corners tagged with the face they belong to, four per face
+    constexpr std::size_t vertices_count = sizeof(CubeVertices) / (3 * sizeof(CubeVertices[0]));
+    std::array<CubeVertex, vertices_count> vertices;
+    for(std::size_t i = 0; i < vertices_count; i++) {
+        CubeVertex& vertex = vertices[i];
+        std::copy_n(&CubeVertices[3 * i], 3, vertex.position);
+        vertex.face = static_cast<GLubyte>(i / 4);
+    }
+
+    // Instances, positions and distance factors are constant so only heights are evaluated every frame
+    std::vector<float> xs;
+    std::vector<float> zs;
+    std::vector<float> distance_factors;
+    for(int i = FIRST_ROW; i < FIRST_ROW + ROWS; ++i) {
+        for(int j = FIRST_COLUMN; j < FIRST_COLUMN + COLUMNS; ++j) {
+            xs.push_back(static_cast<float>(i));
+            zs.push_back(static_cast<float>(j));
+            distance_factors.push_back(static_cast<float>(sqrt(pow(i, 2) + pow(j, 2))) * 0.9f);
+        }
+    }
+    // Heights belong to the frame slots, every frame culls a copy of the batch pointing at its own
+    const CubeBatch batch{ xs.data(), zs.data(), nullptr, xs.size() };
+    const GLsizei instances_count = static_cast<GLsizei>(batch.count);
+
+    // Camera
+    const vec3 eye{ 20.0f, 22.5f, 20.0f };
+    const vec3 target{ 0.0f, 0.0f, 0.0f };
+    const mat4 projection = Perspective(45.0f, static_cast<float>(WindowWidth / WindowHeight), 0.1f, 100.0f);
+    const mat4 view = LookAt(
+        eye,
+        target,
+        { 0.0f, 1.0f, 0.0f }
+    );
+
+    const mat4 pv = Mul(view, projection);
+    const Frustum frustum = ExtractFrustum(pv);
+
+    // Faces the camera can see on any cube, only they are drawn. Has to be recomputed whenever the camera moves.
+    const float lowest = 0.5f * (MIN_CUBE_HEIGHT - CUBE_HEIGHT_MULTIPLIER);
+    const GLubyte cube_faces = VisibleCubeFaces(eye,
+        { static_cast<float>(FIRST_ROW + ROWS) - 1.5f, -lowest, static_cast<float>(FIRST_COLUMN + COLUMNS) - 1.5f },
+        { static_cast<float>(FIRST_ROW) + 0.5f, lowest, static_cast<float>(FIRST_COLUMN) + 0.5f });
+    const std::vector<GLushort> cube_indices = CubeFaceIndices(cube_faces);
+    const GLsizei cube_indices_count = static_cast<GLsizei>(cube_indices.size());
+
+    // Cubes are drawn front to back, the depth test then rejects most hidden fragments before shading. CPU mode
+    // stores the cubes sorted by depth, culling keeps that order. Shaders walk the grid from the corner nearest to
+    // the camera. Both have to be redone whenever the camera moves.
+    if(mode == CubeWaveMode::CpuInstanced) {
+        const std::vector<std::uint32_t> order = FrontToBackOrder(batch, eye, target);
+        const auto reorder = [&order](std::vector<float>& values) {
+            std::vector<float> sorted(values.size());
+            for(std::size_t k = 0; k < order.size(); k++) {
+                sorted[k] = values[order[k]];
+            }
+            std::copy(sorted.begin(), sorted.end(), values.begin());
+        };
+        reorder(xs);
+        reorder(zs);
+        reorder(distance_factors);
+    }
+    const bool reverse_rows = eye[0] > 0.0f;
+    const bool reverse_columns = eye[2] > 0.0f;
+
+    // Buffer objects
+    GLuint vertex_buffer, index_buffer, vao;
+    wglGenBuffers(1, &vertex_buffer);
+    wglGenBuffers(1, &index_buffer);
+    wglGenVertexArrays(1, &vao);
+    StreamBuffer instance_stream = CreateStreamBuffer(GL_ARRAY_BUFFER, sizeof(CubeInstance) * batch.count);
+    GpuCuller culler;
+    if(mode == CubeWaveMode::GpuCulled) {
+        culler = CreateGpuCuller(instances_count);
+        SetGpuCullerFaces(culler, cube_faces);
+    }
+
+    // Merged mesh of the grid, bands rebuilt by the mesher are written over their ranges of the buffers
+    const Heightfield field{ static_cast<std::size_t>(ROWS), static_cast<std::size_t>(COLUMNS),
+                             static_cast<float>(FIRST_ROW), static_cast<float>(FIRST_COLUMN), nullptr };
+    HeightfieldMesher mesher;
+    ProgramReflection mesh_program;
+    HeightfieldMeshBuffers mesh_buffers;
+    if(mode == CubeWaveMode::CpuMeshed) {
+        const GLuint mesh_vertex_shader = CreateShader({ "#version 330 core\n", FrameBlockShaderSource, MeshVertexShaderSource }, GL_VERTEX_SHADER);
+        const GLuint mesh_fragment_shader = CreateShader(FragmentShaderSource, GL_FRAGMENT_SHADER);
+        mesh_program = ReflectProgram(CreateProgram(mesh_vertex_shader, mesh_fragment_shader));
+        wglDeleteShader(mesh_vertex_shader);
+        wglDeleteShader(mesh_fragment_shader);
+        mesh_program.BindUniformBlock("Frame", FrameUniformsBinding);
+        mesh_program.BindUniformBlock("Palette", PaletteBinding);
+        mesh_buffers = CreateHeightfieldMeshBuffers(reverse_rows);
+    }
+    
+    RenderState.BindVertexArray(vao);
+    
+    RenderState.BindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+    wglBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices.data(), GL_STATIC_DRAW);
+    ApplyVertexLayout(CubeVertexLayout);
+
+    // Element buffer binding is part of the VAO state
+    RenderState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+    wglBufferData(GL_ELEMENT_ARRAY_BUFFER, cube_indices.size() * sizeof(GLushort), cube_indices.data(), GL_STATIC_DRAW);
+
+    RenderState.BindBuffer(GL_ARRAY_BUFFER, mode == CubeWaveMode::GpuCulled ? culler.instances : instance_stream.buffer);
+    ApplyVertexLayout(CubeInstanceLayout);
+
+    // Load uniforms
+    RenderState.BindBuffer(GL_UNIFORM_BUFFER, palette_buffer);
+    wglBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(palette), palette.data());
+    RenderState.BindBuffer(GL_UNIFORM_BUFFER, frame_buffer);
+    wglBufferSubData(GL_UNIFORM_BUFFER, offsetof(FrameUniforms, pv), sizeof(pv), &pv[0][0]);
+
+    const auto load_wave_uniforms = [&](const ProgramReflection& program) {
+        RenderState.UseProgram(program.program);
+        wglUniform2i(program.Uniform("gridSize"), ROWS, COLUMNS);
+        wglUniform2i(program.Uniform("reverseCells"), reverse_rows, reverse_columns);
+        wglUniform1f(program.Uniform("SIN_MULTIPLIER"), SIN_MULTIPLIER);
+        wglUniform1f(program.Uniform("CUBE_HEIGHT_MULTIPLIER"), CUBE_HEIGHT_MULTIPLIER);
+        wglUniform1f(program.Uniform("MIN_CUBE_HEIGHT"), MIN_CUBE_HEIGHT);
+    };
+    if(mode == CubeWaveMode::GpuCulled) {
+        load_wave_uniforms(culler.cull_program);
+        wglUniform4fv(culler.cull_program.Uniform("frustum"), static_cast<GLsizei>(frustum.planes.size()), frustum.planes[0].data());
+    }
+    load_wave_uniforms(shader_program);
+    wglUniform1i(shader_program.Uniform("procedural"), mode == CubeWaveMode::GpuProcedural);
+
+    // OpenGL settings
+    RenderState.ClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+    RenderState.Enable(GL_DEPTH_TEST);
+    RenderState.Enable(GL_CULL_FACE);
+
+    FramePacer pacer = CreateFramePacer(options.fps);
+    FixedTimestep timestep = CreateFixedTimestep(options.simulation_rate);
+
+    // State of the two frames being prepared at once, written on the render thread ahead of submission
+    struct FrameSlot {
+        int steps = 0;
+        double time = 0.0;
+        double alpha = 1.0;
+        CubeInstance* instances = nullptr;
+        std::vector<CubeInstance> culled;           // Cubes inside the frustum, packed at the start of every block
+        std::vector<std::size_t> block_visible;     // Number of such cubes in every block of JobGrain cubes
+        std::vector<std::size_t> block_offsets;     // Where the cubes of every block go in instances
+        std::size_t visible = 0;
+        std::vector<float> heights;                 // Interpolated heights rendered in the frame
+        std::vector<float> previous_heights;        // Two latest simulation steps as of the frame
+        std::vector<float> current_heights;
+        std::vector<std::size_t> rebuilt_bands;     // Bands of the merged grid meshed for the frame
+        std::vector<Mesh> band_meshes;              // Swapped with the mesher and the uploaded meshes, never copied
+    };
+    std::array<FrameSlot, 2> slots;
+    const auto slot = [&slots](long frame) -> FrameSlot& {
+        return slots[frame % slots.size()];
+    };
+    const auto wave = [&](float time, std::size_t k) {
+        return CUBE_HEIGHT_MULTIPLIER * sin(SIN_MULTIPLIER * time + distance_factors[k]) + MIN_CUBE_HEIGHT;
+    };
+
+    // CPU modes keep the two latest steps, the procedural shader evaluates both from their times.
+    // Jobs cover multiples of 1024 cubes, keeping CullCubeInstances on its vector path.
+    constexpr std::size_t JobGrain = 1024;
+    const std::size_t blocks = (batch.count + JobGrain - 1) / JobGrain;
+    const bool cpu_heights = mode == CubeWaveMode::CpuInstanced || mode == CubeWaveMode::CpuMeshed;
+    if(mode == CubeWaveMode::CpuInstanced) {
+        for(FrameSlot& frame_slot : slots) {
+            frame_slot.culled.resize(batch.count);
+            frame_slot.block_visible.resize(blocks);
+            frame_slot.block_offsets.resize(blocks);
+        }
+    }
+    if(cpu_heights) {
+        for(FrameSlot& frame_slot : slots) {
+            frame_slot.heights.resize(batch.count);
+            frame_slot.previous_heights.resize(batch.count);
+            frame_slot.current_heights.resize(batch.count);
+        }
+
+        // Frame 0 continues from the other slot
+        FrameSlot& start = slots[1];
+        jobs.ParallelFor(0, batch.count, JobGrain, [&](std::size_t begin, std::size_t end) {
+            for(std::size_t k = begin; k < end; k++) {
+                start.current_heights[k] = wave(0.0f, k);
+            }
+        });
+    }
+
+    // Stages of frame N + 1 up to instance building run while frame N is submitted and presented
+    bool running = true;
+    FramePipeline pipeline(jobs);
+    const std::size_t input = pipeline.AddStage("Input", 0, {}, [&](long) {
+        running = PollPlatformEvents(window);
+        BeginBenchmarkFrame(benchmark);
+    });
+
+    const std::size_t simulate_clock = pipeline.AddStage("Advance clock", 1, {}, [&](long frame) {
+        FrameSlot& next = slot(frame);
+        next.steps = AdvanceFixedTimestep(timestep, FrameTime(options, frame)); // static_cast<float>(glfwGetTime());
+        next.time = timestep.time;
+        next.alpha = timestep.alpha;
+    });
+
+    // Steps the heights of [begin, end) from the previous frame, held by the other slot, to the time of the frame
+    // and interpolates the rendered ones. The previous frame is never written while the next one is prepared.
+    const auto simulate = [&](long frame, std::size_t begin, std::size_t end) {
+        FrameSlot& next = slot(frame);
+        const FrameSlot& last = slot(frame + 1);
+        std::copy(last.previous_heights.begin() + begin, last.previous_heights.begin() + end, next.previous_heights.begin() + begin);
+        std::copy(last.current_heights.begin() + begin, last.current_heights.begin() + end, next.current_heights.begin() + begin);
+        for(int step = next.steps - 1; step >= 0; step--) {
+            const float time = static_cast<float>(next.time - step * timestep.step);
+            for(std::size_t k = begin; k < end; k++) {
+                next.previous_heights[k] = next.current_heights[k];
+                next.current_heights[k] = wave(time, k);
+            }
+        }
+
+        const float alpha = static_cast<float>(next.alpha);
+        for(std::size_t k = begin; k < end; k++) {
+            next.heights[k] = next.previous_heights[k] + (next.current_heights[k] - next.previous_heights[k]) * alpha;
+        }
+    };
+
+    std::size_t build = simulate_clock;
+    if(mode == CubeWaveMode::CpuInstanced) {
+        const std::size_t acquire = pipeline.AddStage("Acquire instances", 1, {}, [&](long frame) {
+            slot(frame).instances = static_cast<CubeInstance*>(BeginStreamWrite(instance_stream, frame % StreamBuffer::Regions));
+        });
+
+        // Every job simulates, interpolates and culls its own range of cubes, visible ones are then
+        // packed into the stream once the offsets of all blocks are known
+        const std::size_t cull = pipeline.AddJobStage("Simulate and cull", 1, { simulate_clock }, batch.count, JobGrain,
+            [&](long frame, std::size_t begin, std::size_t end) {
+                simulate(frame, begin, end);
+
+                FrameSlot& next = slot(frame);
+                const CubeBatch frame_batch{ batch.x, batch.z, next.heights.data(), batch.count };
+                for(std::size_t block_begin = begin; block_begin < end; block_begin += JobGrain) {
+                    const std::size_t block_end = std::min(block_begin + JobGrain, end);
+                    next.block_visible[block_begin / JobGrain] = CullCubeInstances(frame_batch.Slice(block_begin, block_end), frustum, next.culled.data() + block_begin);
+                }
+            });
+
+        const std::size_t count = pipeline.AddStage("Count visible", 1, { cull }, [&](long frame) {
+            FrameSlot& next = slot(frame);
+            next.visible = 0;
+            for(std::size_t block = 0; block < blocks; block++) {
+                next.block_offsets[block] = next.visible;
+                next.visible += next.block_visible[block];
+            }
+        });
+
+        build = pipeline.AddJobStage("Pack instances", 1, { count, acquire }, batch.count, JobGrain,
+            [&](long frame, std::size_t begin, std::size_t end) {
+                const FrameSlot& next = slot(frame);
+                for(std::size_t block = begin / JobGrain; block * JobGrain < end; block++) {
+                    std::copy_n(next.culled.data() + block * JobGrain, next.block_visible[block], next.instances + next.block_offsets[block]);
+                }
+            });
+    } else if(mode == CubeWaveMode::CpuMeshed) {
+        const std::size_t simulate_heights = pipeline.AddJobStage("Simulate", 1, { simulate_clock }, batch.count, JobGrain, simulate);
+
+        // Only bands whose heights changed are remeshed, a frame without changes keeps the uploaded mesh
+        build = pipeline.AddStage("Mesh bands", 1, { simulate_heights }, [&](long frame) {
+            FrameSlot& next = slot(frame);
+            Heightfield frame_field = field;
+            frame_field.heights = next.heights.data();
+            UpdateHeightfieldMesher(mesher, frame_field, cube_faces, jobs);
+            next.rebuilt_bands = mesher.rebuild;
+            next.band_meshes.resize(mesher.rebuild.size());
+            for(std::size_t k = 0; k < mesher.rebuild.size(); k++) {
+                SwapMeshGeometry(next.band_meshes[k], mesher.bands[mesher.rebuild[k]]);
+            }
+        });
+    }
+
+    const std::size_t upload = pipeline.AddStage("Upload", 0, { input, build }, [&](long frame) {
+        // time, previous_time and alpha are adjacent in the block
+        FrameSlot& current = slot(frame);
+        const GLfloat times[] = {
+            static_cast<GLfloat>(current.time),
+            static_cast<GLfloat>(current.time - timestep.step),
+            static_cast<GLfloat>(current.alpha)
+        };
+        RenderState.BindBuffer(GL_UNIFORM_BUFFER, frame_buffer);
+        wglBufferSubData(GL_UNIFORM_BUFFER, offsetof(FrameUniforms, time), sizeof(times), times);
+
+        if(mode == CubeWaveMode::CpuInstanced) {
+            // Whole grid is drawn with a single call sourcing the region written for this frame
+            const int region = frame % StreamBuffer::Regions;
+            const GLintptr offset = instance_stream.Offset(region);
+            RenderState.BindVertexArray(vao);
+            RenderState.BindBuffer(GL_ARRAY_BUFFER, instance_stream.buffer);
+            EndStreamWrite(instance_stream, region, static_cast<GLsizeiptr>(current.visible * sizeof(CubeInstance)));
+            ApplyVertexLayout(CubeInstanceLayout, offset);
+        } else if(mode == CubeWaveMode::GpuCulled) {
+            CullOnGpu(culler);
+        } else if(mode == CubeWaveMode::CpuMeshed && !current.rebuilt_bands.empty()) {
+            // Takes the band meshes of the slot, which gets the replaced ones back for the mesher to rebuild into
+            UpdateHeightfieldMeshBuffers(mesh_buffers, mesher.bands.size(), current.rebuilt_bands, current.band_meshes);
+        }
+        EndGpuPass(benchmark.gpu_profiler, GpuPass::Cull);
+    });
+
+    const std::size_t submit = pipeline.AddStage("Submit", 0, { upload }, [&](long frame) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        EndGpuPass(benchmark.gpu_profiler, GpuPass::Clear);
+
+        if(mode == CubeWaveMode::GpuCulled) {
+            // Survivors are only counted on the GPU
+            DrawGpuCulled(culler, shader_program, vao);
+            benchmark.draw_calls++;
+        } else if(mode == CubeWaveMode::CpuMeshed) {
+            RenderState.UseProgram(mesh_program.program);
+            DrawHeightfieldMeshBuffers(mesh_buffers);
+            benchmark.draw_calls++;
+        } else {
+            RenderState.UseProgram(shader_program.program);
+            RenderState.BindVertexArray(vao);
+            const GLsizei count = mode == CubeWaveMode::CpuInstanced ? static_cast<GLsizei>(slot(frame).visible) : instances_count;
+            wglDrawElementsInstanced(GL_TRIANGLES, cube_indices_count, GL_UNSIGNED_SHORT, nullptr, count);
+            benchmark.draw_calls++;
+            benchmark.instances += count;
+        }
+
+        if(mode == CubeWaveMode::CpuInstanced) {
+            FenceStreamRegion(instance_stream, frame % StreamBuffer::Regions);
+        }
+        EndGpuPass(benchmark.gpu_profiler, GpuPass::Grid);
+    });
+
+    pipeline.AddStage("Present", 0, { submit }, [&](long) {
+        SwapPlatformBuffers(window);
+        EndGpuPass(benchmark.gpu_profiler, GpuPass::Present);
+        EndBenchmarkFrame(benchmark);
+    });
+
+    for(long frame = 0; running && (options.frames == 0 || frame < options.frames); frame++) {
+        PROFILE_ZONE("Frame");
+        pipeline.RunFrame(frame);
+        PaceFrame(pacer);
+    }
+    pipeline.Drain();
+
+    // Free memory
+    DestroyFramePacer(pacer);
+    RenderState.DeleteVertexArray(vao);
+    RenderState.DeleteBuffer(vertex_buffer);
+    RenderState.DeleteBuffer(index_buffer);
+    DestroyStreamBuffer(instance_stream);
+    DestroyGpuCuller(culler);
+    if(mode == CubeWaveMode::CpuMeshed) {
+        wglDeleteProgram(mesh_program.program);
+        DestroyHeightfieldMeshBuffers(mesh_buffers);
+    }
+}
+
+
+/*void PenroseStairs(const Window* window, GLuint shader_program, GLuint palette_buffer) {
+    const Palette palette{{
+        { 0.37f, 0.0f,  0.73f, 1.0f },     // back
+        { 0.37f, 0.0f,  0.73f, 1.0f },     // front
+        { 0.37f, 0.0f,  0.73f, 1.0f },     // left
+        { 0.37f, 0.0f,  0.73f, 1.0f },     // right
+        { 0.63f, 0.61f, 0.91f, 1.0f },     // down
+        { 0.63f, 0.61f, 0.91f, 1.0f }      // top
+    }};
+
+    // Buffer objects
+    GLuint vertex_buffer, vao;
+    glGenBuffers(1, &vertex_buffer);
+    glGenVertexArrays(1, &vao);
+
+    glBindVertexArray(vao);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(CubeVertices), CubeVertices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_TRUE, 0, (void*)0);
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
@@ -716,6 +3118,8 @@ void CubeWave(HDC deviceContext, GLuint shader_program) {
     const float height_modifier = -0.1f;
 
     // Load uniforms
+    glBindBuffer(GL_UNIFORM_BUFFER, palette_buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(palette), palette.data());
     glUseProgram(shader_program);
     glUniformMatrix4fv(glGetUniformLocation(shader_program, "pv"), 1, GL_FALSE, &pv[0][0]);
 
@@ -756,5 +3160,4 @@ void CubeWave(HDC deviceContext, GLuint shader_program) {
     // Free memory
     glDeleteVertexArrays(1, &vao);
     glDeleteBuffers(1, &vertex_buffer);
-    glDeleteBuffers(1, &color_buffer);
 }*/
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/****************
+ * CPU profiler *
+ ****************/
+// Scoped zones recorded into per-thread buffers and exported as Chrome trace_event JSON (chrome://tracing, Perfetto).
+// Only the owning thread appends to its buffer, the registry lock is taken once per thread and when exporting.
+struct ProfileEvent {
+    const char* name;
+    std::int64_t begin_ns;
+    std::int64_t end_ns;
+};
+
+struct ProfileThreadBuffer {
+    std::uint32_t thread_id = 0;
+    const char* name = "Worker";
+    std::vector<ProfileEvent> events;
+};
+
+inline std::atomic<bool> ProfilerEnabled{ false };
+inline std::mutex ProfilerMutex;
+inline std::vector<std::unique_ptr<ProfileThreadBuffer>> ProfilerBuffers;
+inline const auto ProfilerStart = std::chrono::steady_clock::now();
+
+inline std::int64_t ProfilerNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - ProfilerStart).count();
+}
+
+inline ProfileThreadBuffer& ProfilerThreadBuffer() {
+    thread_local ProfileThreadBuffer* buffer = nullptr;
+    if(buffer == nullptr) {
+        std::lock_guard<std::mutex> lock(ProfilerMutex);
+        ProfilerBuffers.push_back(std::make_unique<ProfileThreadBuffer>());
+        buffer = ProfilerBuffers.back().get();
+        buffer->thread_id = static_cast<std::uint32_t>(ProfilerBuffers.size());
+        buffer->events.reserve(1 << 16);
+    }
+
+    return *buffer;
+}
+
+// Names must outlive the profiler, string literals in practice
+inline void NameProfilerThread(const char* name) {
+    ProfilerThreadBuffer().name = name;
+}
+
+class ProfileZone {
+public:
+    explicit ProfileZone(const char* name)
+        : name(name)
+        , begin_ns(ProfilerEnabled.load(std::memory_order_relaxed) ? ProfilerNow() : -1) {
+    }
+
+    ~ProfileZone() {
+        if(begin_ns >= 0) {
+            ProfilerThreadBuffer().events.push_back({ name, begin_ns, ProfilerNow() });
+        }
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    const char* name;
+    std::int64_t begin_ns;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+
+// Threads must not record zones while the trace is written
+inline bool WriteProfilerTrace(const std::string& path) {
+    std::ofstream file(path);
+    file.setf(std::ios::fixed);
+    file.precision(3);
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    std::lock_guard<std::mutex> lock(ProfilerMutex);
+    bool first = true;
+    for(const auto& buffer : ProfilerBuffers) {
+        file << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->thread_id
+             << ",\"args\":{\"name\":\"" << buffer->name << "\"}}";
+        first = false;
+
+        // Complete events in microseconds
+        for(const ProfileEvent& event : buffer->events) {
+            file << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_id
+                 << ",\"ts\":" << event.begin_ns / 1000.0 << ",\"dur\":" << (event.end_ns - event.begin_ns) / 1000.0 << "}";
+        }
+    }
+    file << "\n]}\n";
+
+    return static_cast<bool>(file);
+}
+
+inline const auto startTime = std::chrono::steady_clock::now();
+
+// Nanoseconds since start of the program on a monotonic clock
+inline std::int64_t GetTimeNs() {
+    const auto currentTime = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(currentTime - startTime).count();
+}
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <limits>
+
+// SIMD instruction sets used by the math layer, CUBES_SCALAR_MATH forces the scalar fallback
+#if !defined(CUBES_SCALAR_MATH)
+#if defined(__AVX__)
+#define CUBES_SIMD_AVX
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CUBES_SIMD_SSE2
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CUBES_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+/******************************
+ * Math utilities and helpers *
+ ******************************/
+constexpr float PI = 3.1415926535897931f;
+
+// vec4 is 16 bytes aligned so rows of mat4 can be loaded straight into SIMD registers
+using vec3 = std::array<float, 3>;
+struct alignas(16) vec4 : std::array<float, 4> {};
+using mat4 = std::array<vec4, 4>;
+
+inline bool AlmostEqual(float a, float b) {
+    return std::abs(a - b) < std::numeric_limits<float>::epsilon();
+}
+
+constexpr float ToRadians(float degrees) {
+    return degrees * PI / 180.0f;
+}
+
+constexpr float ToDegrees(float radians) {
+    return radians * 180.0f / PI;
+}
+
+/*
+ * Scalar versions of the functions below are the reference implementation. SIMD versions of
+ * Mul, Translate and Scale perform the same single precision operations in the same order
+ * (no fused multiply-add), so results of both are bit-exact. NormalizeScalar keeps the
+ * original double precision magnitude, the SIMD version computes it in single precision and
+ * stays within a few ulps of it.
+ */
+inline vec3 NormalizeScalar(const vec3& vec) {
+    const float mag = static_cast<float>(std::sqrt(std::pow(vec[0], 2) + std::pow(vec[1], 2) + std::pow(vec[2], 2)));
+
+    if (!AlmostEqual(mag, 1.0f)) {
+        return { vec[0] / mag, vec[1] / mag, vec[2] / mag };
+    } else {
+        return vec;
+    }
+}
+
+inline vec3 Normalize(const vec3& vec) {
+#if defined(CUBES_SIMD_SSE2)
+    const __m128 v = _mm_set_ps(0.0f, vec[2], vec[1], vec[0]);
+    const __m128 squares = _mm_mul_ps(v, v);
+    __m128 sum = _mm_add_ss(squares, _mm_shuffle_ps(squares, squares, _MM_SHUFFLE(1, 1, 1, 1)));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(squares, squares, _MM_SHUFFLE(2, 2, 2, 2)));
+    const __m128 mag = _mm_sqrt_ss(sum);
+
+    if (AlmostEqual(_mm_cvtss_f32(mag), 1.0f)) {
+        return vec;
+    }
+
+    alignas(16) float result[4];
+    _mm_store_ps(result, _mm_div_ps(v, _mm_shuffle_ps(mag, mag, _MM_SHUFFLE(0, 0, 0, 0))));
+    return { result[0], result[1], result[2] };
+#elif defined(CUBES_SIMD_NEON)
+    const float lanes[4] = { vec[0], vec[1], vec[2], 0.0f };
+    const float32x4_t v = vld1q_f32(lanes);
+    const float32x4_t squares = vmulq_f32(v, v);
+    const float mag = std::sqrt(vgetq_lane_f32(squares, 0) + vgetq_lane_f32(squares, 1) + vgetq_lane_f32(squares, 2));
+
+    if (AlmostEqual(mag, 1.0f)) {
+        return vec;
+    }
+
+    float result[4];
+    vst1q_f32(result, vdivq_f32(v, vdupq_n_f32(mag)));
+    return { result[0], result[1], result[2] };
+#else
+    return NormalizeScalar(vec);
+#endif
+}
+
+constexpr vec3 Cross(const vec3& first, const vec3& second) {
+    return {
+        first[1] * second[2] - first[2] * second[1],
+        first[2] * second[0] - first[0] * second[2],
+        first[0] * second[1] - first[1] * second[0]
+    };
+}
+
+constexpr mat4 MulScalar(const mat4& first, const mat4& second) {
+    mat4 result{ 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            for (int k = 0; k < 4; k++) {
+                result[i][j] += static_cast<float>(first[i][k] * second[k][j]);
+            }
+        }
+    }
+
+    return result;
+}
+
+// Row i of the result is a linear combination of rows of the second matrix weighted by row i of the first
+inline mat4 Mul(const mat4& first, const mat4& second) {
+    mat4 result;
+
+#if defined(CUBES_SIMD_AVX)
+    const __m256 rows[4] = {
+        _mm256_broadcast_ps(reinterpret_cast<const __m128*>(second[0].data())),
+        _mm256_broadcast_ps(reinterpret_cast<const __m128*>(second[1].data())),
+        _mm256_broadcast_ps(reinterpret_cast<const __m128*>(second[2].data())),
+        _mm256_broadcast_ps(reinterpret_cast<const __m128*>(second[3].data()))
+    };
+
+    // Two rows of the result per iteration, mat4 is only 16 bytes aligned so the pairs are accessed unaligned
+    for (int i = 0; i < 4; i += 2) {
+        const __m256 weights = _mm256_loadu_ps(first[i].data());
+        __m256 sum = _mm256_setzero_ps();
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_permute_ps(weights, _MM_SHUFFLE(0, 0, 0, 0)), rows[0]));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_permute_ps(weights, _MM_SHUFFLE(1, 1, 1, 1)), rows[1]));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_permute_ps(weights, _MM_SHUFFLE(2, 2, 2, 2)), rows[2]));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_permute_ps(weights, _MM_SHUFFLE(3, 3, 3, 3)), rows[3]));
+        _mm256_storeu_ps(result[i].data(), sum);
+    }
+#elif defined(CUBES_SIMD_SSE2)
+    const __m128 rows[4] = {
+        _mm_load_ps(second[0].data()),
+        _mm_load_ps(second[1].data()),
+        _mm_load_ps(second[2].data()),
+        _mm_load_ps(second[3].data())
+    };
+
+    for (int i = 0; i < 4; i++) {
+        __m128 sum = _mm_setzero_ps();
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(first[i][0]), rows[0]));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(first[i][1]), rows[1]));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(first[i][2]), rows[2]));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(first[i][3]), rows[3]));
+        _mm_store_ps(result[i].data(), sum);
+    }
+#elif defined(CUBES_SIMD_NEON)
+    const float32x4_t rows[4] = {
+        vld1q_f32(second[0].data()),
+        vld1q_f32(second[1].data()),
+        vld1q_f32(second[2].data()),
+        vld1q_f32(second[3].data())
+    };
+
+    for (int i = 0; i < 4; i++) {
+        float32x4_t sum = vdupq_n_f32(0.0f);
+        sum = vaddq_f32(sum, vmulq_n_f32(rows[0], first[i][0]));
+        sum = vaddq_f32(sum, vmulq_n_f32(rows[1], first[i][1]));
+        sum = vaddq_f32(sum, vmulq_n_f32(rows[2], first[i][2]));
+        sum = vaddq_f32(sum, vmulq_n_f32(rows[3], first[i][3]));
+        vst1q_f32(result[i].data(), sum);
+    }
+#else
+    result = MulScalar(first, second);
+#endif
+
+    return result;
+}
+
+inline mat4 Perspective(float fov, float aspect, float near, float far) {
+    const float top = tan(ToRadians(fov) / 2.0f) * near;
+    const float right = top * aspect;
+
+    return {
+        near / right, 0.0f,       0.0f,                           0.0f,
+        0.0f,         near / top, 0.0f,                           0.0f,
+        0.0f,         0.0f,       -(far + near) / (far - near),   -1.0f,
+        0.0f,         0.0f,       -2 * far * near / (far - near), 0.0f
+    };
+}
+
+// Builds the view matrix with the given normalization and multiplication
+template<typename NormalizeFunction, typename MulFunction>
+inline mat4 LookAtWith(const vec3& pos, const vec3& target, const vec3& up, NormalizeFunction normalize, MulFunction mul) {
+    const vec3 z_axis = normalize({ pos[0] - target[0], pos[1] - target[1], pos[2] - target[2] });
+    const vec3 x_axis = normalize(Cross(normalize(up), z_axis));
+    const vec3 y_axis = Cross(z_axis, x_axis);
+
+    mat4 translation{
+        1.0f,    0.0f,    0.0f,    0.0f,
+        0.0f,    1.0f,    0.0f,    0.0f,
+        0.0f,    0.0f,    1.0f,    0.0f,
+        -pos[0], -pos[1], -pos[2], 1.0f
+    };
+
+    mat4 rotation{
+        x_axis[0], y_axis[0], z_axis[0], 0.0f,
+        x_axis[1], y_axis[1], z_axis[1], 0.0f,
+        x_axis[2], y_axis[2], z_axis[2], 0.0f,
+        0.0f,      0.0f,      0.0f,      1.0f
+    };
+
+    return mul(translation, rotation);
+}
+
+inline mat4 LookAtScalar(const vec3& pos, const vec3& target, const vec3& up) {
+    return LookAtWith(pos, target, up, NormalizeScalar, MulScalar);
+}
+
+inline mat4 LookAt(const vec3& pos, const vec3& target, const vec3& up) {
+    return LookAtWith(pos, target, up, Normalize, Mul);
+}
+
+constexpr mat4 TranslateScalar(const mat4& matrix, const vec3& vec) {
+    return {
+        matrix[0][0],          matrix[0][1],          matrix[0][2],          matrix[0][3],
+        matrix[1][0],          matrix[1][1],          matrix[1][2],          matrix[1][3],
+        matrix[2][0],          matrix[2][1],          matrix[2][2],          matrix[2][3],
+        matrix[3][0] + vec[0], matrix[3][1] + vec[1], matrix[3][2] + vec[2], matrix[3][3]
+    };
+}
+
+// Adding -0.0f leaves the w component untouched, including the sign of zero
+inline mat4 Translate(const mat4& matrix, const vec3& vec) {
+#if defined(CUBES_SIMD_SSE2)
+    mat4 result = matrix;
+    _mm_store_ps(result[3].data(), _mm_add_ps(_mm_load_ps(matrix[3].data()), _mm_set_ps(-0.0f, vec[2], vec[1], vec[0])));
+    return result;
+#elif defined(CUBES_SIMD_NEON)
+    mat4 result = matrix;
+    const float offset[4] = { vec[0], vec[1], vec[2], -0.0f };
+    vst1q_f32(result[3].data(), vaddq_f32(vld1q_f32(matrix[3].data()), vld1q_f32(offset)));
+    return result;
+#else
+    return TranslateScalar(matrix, vec);
+#endif
+}
+
+constexpr mat4 ScaleScalar(const mat4& matrix, const vec3& vec) {
+    return {
+        matrix[0][0] * vec[0], matrix[0][1],          matrix[0][2],          matrix[0][3],
+        matrix[1][0],          matrix[1][1] * vec[1], matrix[1][2],          matrix[1][3],
+        matrix[2][0],          matrix[2][1],          matrix[2][2] * vec[2], matrix[2][3],
+        matrix[3][0],          matrix[3][1],          matrix[3][2],          matrix[3][3]
+    };
+}
+
+// Multiplying by 1.0f leaves the other components untouched
+inline mat4 Scale(const mat4& matrix, const vec3& vec) {
+#if defined(CUBES_SIMD_SSE2)
+    mat4 result;
+    _mm_store_ps(result[0].data(), _mm_mul_ps(_mm_load_ps(matrix[0].data()), _mm_set_ps(1.0f, 1.0f, 1.0f, vec[0])));
+    _mm_store_ps(result[1].data(), _mm_mul_ps(_mm_load_ps(matrix[1].data()), _mm_set_ps(1.0f, 1.0f, vec[1], 1.0f)));
+    _mm_store_ps(result[2].data(), _mm_mul_ps(_mm_load_ps(matrix[2].data()), _mm_set_ps(1.0f, vec[2], 1.0f, 1.0f)));
+    result[3] = matrix[3];
+    return result;
+#elif defined(CUBES_SIMD_NEON)
+    mat4 result;
+    vst1q_f32(result[0].data(), vmulq_f32(vld1q_f32(matrix[0].data()), vsetq_lane_f32(vec[0], vdupq_n_f32(1.0f), 0)));
+    vst1q_f32(result[1].data(), vmulq_f32(vld1q_f32(matrix[1].data()), vsetq_lane_f32(vec[1], vdupq_n_f32(1.0f), 1)));
+    vst1q_f32(result[2].data(), vmulq_f32(vld1q_f32(matrix[2].data()), vsetq_lane_f32(vec[2], vdupq_n_f32(1.0f), 2)));
+    result[3] = matrix[3];
+    return result;
+#else
+    return ScaleScalar(matrix, vec);
+#endif
+}
@@ -0,0 +1,336 @@
+// Checks the CPU kernels of CubeWave against brute-force versions: frustum culling, the job system, heightfield
+// meshing and the front to back order. Built once per instruction set, see CMakeLists.txt.
+#include "cube_batch.h"
+#include "heightfield_mesh.h"
+#include "job_system.h"
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace {
+
+std::mt19937 Generator(1234);
+int Failures = 0;
+
+float RandomFloat(float low, float high) {
+    return std::uniform_real_distribution<float>(low, high)(Generator);
+}
+
+void Expect(bool condition, const char* name, int iteration) {
+    if (!condition) {
+        std::cerr << name << " failed in iteration " << iteration << '\n';
+        Failures++;
+    }
+}
+
+struct RandomCubes {
+    std::vector<float> x;
+    std::vector<float> z;
+    std::vector<float> height;
+
+    explicit RandomCubes(std::size_t count) {
+        for (std::size_t k = 0; k < count; k++) {
+            x.push_back(RandomFloat(-40.0f, 40.0f));
+            z.push_back(RandomFloat(-40.0f, 40.0f));
+            height.push_back(RandomFloat(-8.0f, 8.0f));
+        }
+    }
+
+    CubeBatch Batch() const {
+        return { x.data(), z.data(), height.data(), x.size() };
+    }
+};
+
+// Point p is inside the clip volume when -w <= x, y, z <= w of p * pv
+bool InsideClipVolume(const mat4& pv, const vec3& p) {
+    std::array<float, 4> clip{};
+    for (int j = 0; j < 4; j++) {
+        clip[j] = p[0] * pv[0][j] + p[1] * pv[1][j] + p[2] * pv[2][j] + pv[3][j];
+    }
+    for (int j = 0; j < 3; j++) {
+        if (clip[j] < -clip[3] || clip[j] > clip[3]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A cube is visible when any point of a 5 x 5 x 5 lattice over its box is inside the clip volume
+bool CubeVisibleBruteForce(const mat4& pv, float x, float z, float height) {
+    constexpr int Steps = 4;
+    const float half_height = 0.5f * std::abs(height);
+    for (int i = 0; i <= Steps; i++) {
+        for (int j = 0; j <= Steps; j++) {
+            for (int k = 0; k <= Steps; k++) {
+                const vec3 p{
+                    x - 0.5f + static_cast<float>(i) / Steps,
+                    -half_height + 2.0f * half_height * static_cast<float>(j) / Steps,
+                    z - 0.5f + static_cast<float>(k) / Steps
+                };
+                if (InsideClipVolume(pv, p)) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+void TestCulling() {
+    std::size_t kept = 0;
+    std::size_t total = 0;
+    for (int iteration = 0; iteration < 50; iteration++) {
+        // Odd count and offset slices go through every SIMD width and the scalar tail
+        const RandomCubes cubes(1003);
+        const float angle = RandomFloat(0.0f, 2.0f * PI);
+        const float distance = RandomFloat(15.0f, 50.0f);
+        const vec3 eye{ distance * std::cos(angle), RandomFloat(2.0f, 40.0f), distance * std::sin(angle) };
+        const vec3 target{ RandomFloat(-5.0f, 5.0f), 0.0f, RandomFloat(-5.0f, 5.0f) };
+        const mat4 pv = Mul(LookAt(eye, target, { 0.0f, 1.0f, 0.0f }), Perspective(RandomFloat(30.0f, 90.0f), RandomFloat(0.5f, 2.0f), 0.1f, 100.0f));
+        const Frustum frustum = ExtractFrustum(pv);
+        const std::array<CubePlane, 6> planes = PrepareCubePlanes(frustum);
+
+        const std::size_t offset = static_cast<std::size_t>(iteration % 8);
+        const CubeBatch batch = cubes.Batch().Slice(offset, cubes.x.size());
+        std::vector<CubeInstance> culled(batch.count);
+        const std::size_t visible = CullCubeInstances(batch, frustum, culled.data());
+
+        // Survivors keep their order and match the scalar test exactly, no cube that shows is rejected
+        std::size_t next = 0;
+        bool same_as_scalar = true;
+        bool conservative = true;
+        for (std::size_t k = 0; k < batch.count; k++) {
+            const bool kept_cube = next < visible && culled[next].x == batch.x[k] && culled[next].z == batch.z[k] && culled[next].height == batch.height[k];
+            if (kept_cube) {
+                next++;
+            }
+            same_as_scalar = same_as_scalar && kept_cube == CubeVisibleScalar(planes, batch.x[k], batch.z[k], batch.height[k]);
+            conservative = conservative && (kept_cube || !CubeVisibleBruteForce(pv, batch.x[k], batch.z[k], batch.height[k]));
+        }
+        Expect(next == visible, "Culled cubes in their original order", iteration);
+        Expect(same_as_scalar, "Culling matches CubeVisibleScalar", iteration);
+        Expect(conservative, "Culling keeps every visible cube", iteration);
+
+        kept += visible;
+        total += batch.count;
+    }
+
+    // Cameras look at the middle of the cubes, a test rejecting nothing or everything proves little
+    Expect(kept > total / 10 && kept < total - total / 10, "Culling rejects some cubes", 0);
+}
+
+void TestParallelFor() {
+    for (unsigned threads : { 1u, 2u, 4u, 7u }) {
+        JobSystem jobs(threads);
+        for (int iteration = 0; iteration < 100; iteration++) {
+            const std::size_t begin = std::uniform_int_distribution<std::size_t>(0, 50)(Generator);
+            const std::size_t end = begin + std::uniform_int_distribution<std::size_t>(0, 5000)(Generator);
+            const std::size_t grain = std::uniform_int_distribution<std::size_t>(1, 100)(Generator);
+
+            std::vector<std::atomic<int>> visits(end + 10);
+            std::atomic<bool> aligned{ true };
+            jobs.ParallelFor(begin, end, grain, [&](std::size_t chunk_begin, std::size_t chunk_end) {
+                if ((chunk_begin - begin) % grain != 0 || (chunk_end != end && (chunk_end - chunk_begin) % grain != 0)) {
+                    aligned = false;
+                }
+                for (std::size_t i = chunk_begin; i < chunk_end; i++) {
+                    visits[i]++;
+                }
+            });
+
+            bool once = true;
+            for (std::size_t i = 0; i < visits.size(); i++) {
+                once = once && visits[i] == (i >= begin && i < end ? 1 : 0);
+            }
+            Expect(once, "ParallelFor visits every index exactly once", iteration);
+            Expect(aligned, "ParallelFor chunks are multiples of the grain", iteration);
+        }
+    }
+}
+
+// Area of the faces of a mesh by CubeFace, and whether every triangle faces outwards like the cube faces do
+struct FaceAreas {
+    std::array<double, 6> area{};
+    std::array<std::size_t, 6> triangles{};
+    bool outwards = true;
+
+    void Add(const Mesh& mesh) {
+        constexpr std::array<vec3, 6> Normals{ {
+            { 0.0f, 0.0f, -1.0f }, { 0.0f, 0.0f, 1.0f }, { -1.0f, 0.0f, 0.0f },
+            { 1.0f, 0.0f, 0.0f }, { 0.0f, -1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }
+        } };
+
+        for (std::size_t i = 0; i < mesh.indices.size(); i += 3) {
+            const MeshVertex& a = mesh.vertices[mesh.indices[i]];
+            const MeshVertex& b = mesh.vertices[mesh.indices[i + 1]];
+            const MeshVertex& c = mesh.vertices[mesh.indices[i + 2]];
+            const vec3 normal = Cross(
+                { b.position[0] - a.position[0], b.position[1] - a.position[1], b.position[2] - a.position[2] },
+                { c.position[0] - a.position[0], c.position[1] - a.position[1], c.position[2] - a.position[2] });
+            const vec3& expected = Normals[a.face];
+            const double dot = normal[0] * expected[0] + normal[1] * expected[1] + normal[2] * expected[2];
+            const double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+            outwards = outwards && dot > 0.0 && std::abs(dot - length) < 1e-4 * length;
+            area[a.face] += 0.5 * length;
+            triangles[a.face]++;
+        }
+    }
+};
+
+// Every column shows its top and bottom, a wall shows the difference of the heights on both sides towards the
+// shorter column
+FaceAreas ExposedAreas(const Heightfield& field) {
+    FaceAreas exposed;
+    const std::ptrdiff_t rows = static_cast<std::ptrdiff_t>(field.rows);
+    const std::ptrdiff_t columns = static_cast<std::ptrdiff_t>(field.columns);
+    for (std::ptrdiff_t i = -1; i < rows; i++) {
+        for (std::ptrdiff_t j = -1; j < columns; j++) {
+            if (field.Height(i, j) > 0.0f) {
+                exposed.area[static_cast<int>(CubeFace::Top)] += 1.0;
+                exposed.area[static_cast<int>(CubeFace::Down)] += 1.0;
+            }
+            const double along_x = field.Height(i, j) - field.Height(i + 1, j);
+            exposed.area[static_cast<int>(along_x > 0.0 ? CubeFace::Right : CubeFace::Left)] += std::abs(along_x);
+            const double along_z = field.Height(i, j) - field.Height(i, j + 1);
+            exposed.area[static_cast<int>(along_z > 0.0 ? CubeFace::Front : CubeFace::Back)] += std::abs(along_z);
+        }
+    }
+    return exposed;
+}
+
+FaceAreas MeshedAreas(const HeightfieldMesher& mesher) {
+    FaceAreas meshed;
+    for (const Mesh& band : mesher.bands) {
+        meshed.Add(band);
+    }
+    return meshed;
+}
+
+void ExpectAreas(const FaceAreas& meshed, const FaceAreas& exposed, int iteration) {
+    bool same = true;
+    for (std::size_t face = 0; face < 6; face++) {
+        same = same && std::abs(meshed.area[face] - exposed.area[face]) < 1e-3 * (1.0 + exposed.area[face]);
+    }
+    Expect(same, "Meshed face area matches the exposed area", iteration);
+    Expect(meshed.outwards, "Meshed triangles face outwards", iteration);
+}
+
+void TestHeightfieldMesher() {
+    JobSystem jobs(4);
+    for (int iteration = 0; iteration < 40; iteration++) {
+        // Few distinct heights so neighbouring columns often match and faces get merged
+        const std::size_t rows = std::uniform_int_distribution<std::size_t>(1, 3 * HeightfieldBandRows + 5)(Generator);
+        const std::size_t columns = std::uniform_int_distribution<std::size_t>(1, 40)(Generator);
+        std::vector<float> heights(rows * columns);
+        for (float& height : heights) {
+            height = 0.5f * static_cast<float>(std::uniform_int_distribution<int>(0, 4)(Generator));
+        }
+        const Heightfield field{ rows, columns, -static_cast<float>(rows / 2), -static_cast<float>(columns / 2), heights.data() };
+
+        HeightfieldMesher mesher;
+        Expect(UpdateHeightfieldMesher(mesher, field, AllCubeFaces, jobs) == mesher.bands.size(), "First update builds every band", iteration);
+        ExpectAreas(MeshedAreas(mesher), ExposedAreas(field), iteration);
+        Expect(UpdateHeightfieldMesher(mesher, field, AllCubeFaces, jobs) == 0, "Unchanged heights rebuild nothing", iteration);
+
+        // A changed row rebuilds its band and the band before it, which owns the wall towards the row
+        const std::size_t row = std::uniform_int_distribution<std::size_t>(0, rows - 1)(Generator);
+        for (std::size_t j = 0; j < columns; j++) {
+            heights[row * columns + j] += 1.0f;
+        }
+        UpdateHeightfieldMesher(mesher, field, AllCubeFaces, jobs);
+        std::vector<std::size_t> expected_rebuild;
+        if (row % HeightfieldBandRows == 0 && row > 0) {
+            expected_rebuild.push_back(row / HeightfieldBandRows - 1);
+        }
+        expected_rebuild.push_back(row / HeightfieldBandRows);
+        Expect(mesher.rebuild == expected_rebuild, "Changed row rebuilds only its bands", iteration);
+        ExpectAreas(MeshedAreas(mesher), ExposedAreas(field), iteration);
+    }
+
+    // Flat grid merges into a single top and bottom quad per band
+    const std::size_t rows = 2 * HeightfieldBandRows + 7;
+    const std::size_t columns = 25;
+    const std::vector<float> flat(rows * columns, 1.5f);
+    const Heightfield field{ rows, columns, 0.0f, 0.0f, flat.data() };
+    HeightfieldMesher mesher;
+    UpdateHeightfieldMesher(mesher, field, AllCubeFaces, jobs);
+    bool single_quad = true;
+    for (const Mesh& band : mesher.bands) {
+        FaceAreas areas;
+        areas.Add(band);
+        single_quad = single_quad && areas.triangles[static_cast<int>(CubeFace::Top)] == 2 && areas.triangles[static_cast<int>(CubeFace::Down)] == 2;
+    }
+    Expect(single_quad, "Flat band has one top and one bottom quad", 0);
+    ExpectAreas(MeshedAreas(mesher), ExposedAreas(field), 0);
+
+    // Faces outside the mask are left out
+    const std::uint8_t faces = CubeFaceBit(CubeFace::Top) | CubeFaceBit(CubeFace::Right);
+    UpdateHeightfieldMesher(mesher, field, faces, jobs);
+    const FaceAreas masked = MeshedAreas(mesher);
+    bool only_masked = true;
+    for (std::size_t face = 0; face < 6; face++) {
+        only_masked = only_masked && ((faces & CubeFaceBit(static_cast<CubeFace>(face))) != 0 || masked.triangles[face] == 0);
+    }
+    Expect(only_masked, "Mesher keeps only the faces in the mask", 0);
+}
+
+void TestFrontToBackOrder() {
+    for (int iteration = 0; iteration < 50; iteration++) {
+        const RandomCubes cubes(std::uniform_int_distribution<std::size_t>(1, 5000)(Generator));
+        const CubeBatch batch = cubes.Batch();
+        const vec3 eye{ RandomFloat(-50.0f, 50.0f), RandomFloat(1.0f, 50.0f), RandomFloat(-50.0f, 50.0f) };
+        const vec3 target{ RandomFloat(-5.0f, 5.0f), 0.0f, RandomFloat(-5.0f, 5.0f) };
+        const std::vector<std::uint32_t> order = FrontToBackOrder(batch, eye, target);
+
+        std::vector<std::uint32_t> sorted = order;
+        std::sort(sorted.begin(), sorted.end());
+        std::vector<std::uint32_t> indices(batch.count);
+        std::iota(indices.begin(), indices.end(), 0u);
+        Expect(sorted == indices, "Front to back order is a permutation", iteration);
+        if (sorted != indices) {
+            continue;
+        }
+
+        // Depths are quantized to 16 bits, cubes closer than a step apart may come in either order
+        const vec3 forward{ target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+        std::vector<float> depths(batch.count);
+        for (std::size_t k = 0; k < batch.count; k++) {
+            depths[k] = (batch.x[k] - eye[0]) * forward[0] - eye[1] * forward[1] + (batch.z[k] - eye[2]) * forward[2];
+        }
+        const auto bounds = std::minmax_element(depths.begin(), depths.end());
+        const float step = (*bounds.second - *bounds.first) / 65535.0f * 1.01f;
+        bool monotonic = true;
+        for (std::size_t k = 1; k < order.size(); k++) {
+            monotonic = monotonic && depths[order[k]] >= depths[order[k - 1]] - step;
+        }
+        Expect(monotonic, "Front to back order is monotonic", iteration);
+    }
+
+    // Cubes at the same depth keep their order
+    const std::vector<float> x(100, 3.0f), z(100, -2.0f), height(100, 1.0f);
+    const std::vector<std::uint32_t> order = FrontToBackOrder({ x.data(), z.data(), height.data(), x.size() }, { 20.0f, 20.0f, 20.0f }, { 0.0f, 0.0f, 0.0f });
+    std::vector<std::uint32_t> indices(x.size());
+    std::iota(indices.begin(), indices.end(), 0u);
+    Expect(order == indices, "Front to back order is stable", 0);
+}
+
+}
+
+int main() {
+    TestCulling();
+    TestParallelFor();
+    TestHeightfieldMesher();
+    TestFrontToBackOrder();
+
+    if (Failures > 0) {
+        std::cerr << Failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << "All checks passed\n";
+    return 0;
+}
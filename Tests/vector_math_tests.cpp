@@ -0,0 +1,137 @@
+// Compares the SIMD paths of the math layer with the scalar reference. Mul, Translate and Scale have to be
+// bit-exact, Normalize and LookAt within a few ulps of the original double precision normalization.
+// Built once per instruction set, see CMakeLists.txt.
+#include "vector_math.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <random>
+
+namespace {
+
+std::mt19937 Generator(1234);
+int Failures = 0;
+
+float RandomFloat() {
+    return std::uniform_real_distribution<float>(-100.0f, 100.0f)(Generator);
+}
+
+vec3 RandomVec3() {
+    return { RandomFloat(), RandomFloat(), RandomFloat() };
+}
+
+mat4 RandomMat4() {
+    mat4 matrix;
+    for (vec4& row : matrix) {
+        for (float& value : row) {
+            value = RandomFloat();
+        }
+    }
+    return matrix;
+}
+
+// Every component within tolerance times the larger of 1 and scale
+template<typename T>
+void ExpectNear(const T& actual, const T& expected, float scale, const char* name, int iteration) {
+    constexpr float Tolerance = 16.0f * std::numeric_limits<float>::epsilon();
+    const float* a = reinterpret_cast<const float*>(&actual);
+    const float* e = reinterpret_cast<const float*>(&expected);
+    for (std::size_t k = 0; k < sizeof(T) / sizeof(float); k++) {
+        if (!(std::abs(a[k] - e[k]) <= Tolerance * std::max({ 1.0f, scale, std::abs(e[k]) }))) {
+            std::cerr << name << " is off in iteration " << iteration << ": " << a[k] << " != " << e[k] << '\n';
+            Failures++;
+            return;
+        }
+    }
+}
+
+template<typename T>
+void Expect(const T& actual, const T& expected, const char* name, int iteration) {
+    if (std::memcmp(&actual, &expected, sizeof(T)) != 0) {
+        std::cerr << name << " differs from the scalar version in iteration " << iteration << '\n';
+        Failures++;
+    }
+}
+
+// mat4 placed at an address that is 16 mod 32, the worst alignment vec4 allows
+struct MisalignedMat4 {
+    alignas(32) unsigned char storage[sizeof(mat4) + 16];
+
+    mat4* Place(const mat4& value) {
+        return new (storage + 16) mat4(value);
+    }
+};
+
+}
+
+int main() {
+    std::cout << "Math layer:"
+#if defined(CUBES_SIMD_AVX)
+        << " AVX"
+#endif
+#if defined(CUBES_SIMD_SSE2)
+        << " SSE2"
+#elif defined(CUBES_SIMD_NEON)
+        << " NEON"
+#endif
+#if defined(CUBES_SCALAR_MATH)
+        << " scalar"
+#endif
+        << '\n';
+
+    constexpr int Iterations = 10000;
+    for (int i = 0; i < Iterations; i++) {
+        const mat4 first = RandomMat4();
+        const mat4 second = RandomMat4();
+        const vec3 vec = RandomVec3();
+
+        Expect(Mul(first, second), MulScalar(first, second), "Mul", i);
+        Expect(Translate(first, vec), TranslateScalar(first, vec), "Translate", i);
+        Expect(Scale(first, vec), ScaleScalar(first, vec), "Scale", i);
+        ExpectNear(Normalize(vec), NormalizeScalar(vec), 1.0f, "Normalize", i);
+
+        // Unit vectors take the early return of both versions
+        const vec3 unit = NormalizeScalar(vec);
+        ExpectNear(Normalize(unit), NormalizeScalar(unit), 1.0f, "Normalize of a unit vector", i);
+
+        // Translation row of the view is a dot product with the position, its error scales with the position
+        const vec3 pos = RandomVec3();
+        const vec3 target = RandomVec3();
+        const vec3 up = RandomVec3();
+        const float extent = std::max({ std::abs(pos[0]), std::abs(pos[1]), std::abs(pos[2]) });
+        const mat4 view = LookAt(pos, target, up);
+        ExpectNear(view, LookAtScalar(pos, target, up), extent, "LookAt", i);
+
+        const float fov = 10.0f + 160.0f * std::uniform_real_distribution<float>(0.0f, 1.0f)(Generator);
+        const float aspect = std::uniform_real_distribution<float>(0.25f, 4.0f)(Generator);
+        const mat4 projection = Perspective(fov, aspect, 0.1f, 100.0f);
+        Expect(Mul(view, projection), MulScalar(view, projection), "Mul of view and projection", i);
+
+        MisalignedMat4 a, b, result;
+        const mat4* misaligned_first = a.Place(first);
+        const mat4* misaligned_second = b.Place(second);
+        const mat4* product = new (result.storage + 16) mat4(Mul(*misaligned_first, *misaligned_second));
+        Expect(*product, MulScalar(first, second), "Mul of misaligned matrices", i);
+        Expect(Translate(*misaligned_first, vec), TranslateScalar(first, vec), "Translate of a misaligned matrix", i);
+        Expect(Scale(*misaligned_first, vec), ScaleScalar(first, vec), "Scale of a misaligned matrix", i);
+    }
+
+    // Projection of the demo camera, a 90 degree square frustum maps the near plane to -1 and the far plane to 1
+    const mat4 projection = Perspective(90.0f, 1.0f, 1.0f, 3.0f);
+    const mat4 expected_projection{ 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, -2.0f, -1.0f, 0.0f, 0.0f, -3.0f, 0.0f };
+    ExpectNear(projection, expected_projection, 1.0f, "Perspective", 0);
+
+    // Camera on the z axis looking at the origin is a plain translation
+    const mat4 view = LookAt({ 0.0f, 0.0f, 5.0f }, { 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f });
+    const mat4 expected_view{ 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, -5.0f, 1.0f };
+    ExpectNear(view, expected_view, 1.0f, "LookAt", 0);
+
+    if (Failures > 0) {
+        std::cerr << Failures << " checks failed\n";
+        return 1;
+    }
+    std::cout << "All checks passed\n";
+    return 0;
+}